@@ -0,0 +1,84 @@
+#ifndef ARROW_RING_H
+#define ARROW_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef MAX_ARROWS
+#define MAX_ARROWS 100
+#endif
+
+// Arrow structure
+typedef struct {
+    float x;
+    int direction; // 0: up, 1: down, 2: left, 3: right
+    float hitTime; // Time the arrow reaches the target line, when scheduled
+    bool active;
+} Arrow;
+
+// Fixed-capacity FIFO of arrows. Arrows spawn at the top and all fall at the
+// same speed, so they leave the screen in spawn order and expire from the head.
+// A hit in the middle only clears `active`; the hole is reclaimed once it
+// reaches either end, so spawn, expire and hit are all O(1).
+typedef struct {
+    Arrow arrows[MAX_ARROWS];
+    int head;  // Slot of the oldest arrow
+    int count; // Slots in use from head, including inactive holes
+} ArrowRing;
+
+static inline void ArrowRingClear(ArrowRing* ring) {
+    ring->head = 0;
+    ring->count = 0;
+}
+
+// Function to get the i-th arrow counting from the oldest
+static inline Arrow* ArrowRingAt(ArrowRing* ring, int i) {
+    int slot = ring->head + i;
+    if (slot >= MAX_ARROWS) slot -= MAX_ARROWS;
+    return &ring->arrows[slot];
+}
+
+// Function to claim a slot at the tail, NULL when full
+static inline Arrow* ArrowRingPush(ArrowRing* ring) {
+    if (ring->count >= MAX_ARROWS) return NULL;
+    Arrow* arrow = ArrowRingAt(ring, ring->count);
+    arrow->active = true;
+    ring->count++;
+    return arrow;
+}
+
+// Function to drop inactive arrows from both ends
+static inline void ArrowRingTrim(ArrowRing* ring) {
+    while (ring->count > 0 && !ring->arrows[ring->head].active) {
+        ring->head = ring->head + 1 == MAX_ARROWS ? 0 : ring->head + 1;
+        ring->count--;
+    }
+    while (ring->count > 0 && !ArrowRingAt(ring, ring->count - 1)->active) {
+        ring->count--;
+    }
+}
+
+// Function to remove the i-th arrow counting from the oldest
+static inline void ArrowRingRemove(ArrowRing* ring, int i) {
+    if (i < 0 || i >= ring->count) return;
+    ArrowRingAt(ring, i)->active = false;
+    ArrowRingTrim(ring);
+}
+
+// Function to get where an arrow is at `time`, from its hitTime, the line it
+// is scheduled to cross and its speed. Reads only, so drawing can use it on
+// state the simulation owns.
+static inline float ArrowY(const Arrow* arrow, float lineY, float time, float speed) {
+    return lineY - (arrow->hitTime - time) * speed;
+}
+
+// Function to expire arrows from the head whose hit time is before `time`.
+// Same order as expiring by position, but touches only the expired arrows.
+static inline void ArrowRingExpireBefore(ArrowRing* ring, float time) {
+    while (ring->count > 0 && ring->arrows[ring->head].hitTime < time) {
+        ring->arrows[ring->head].active = false;
+        ArrowRingTrim(ring);
+    }
+}
+
+#endif
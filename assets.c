@@ -0,0 +1,178 @@
+#include "assets.h"
+#include "rlgl.h"
+#include <math.h>
+#include <unistd.h>
+
+// Function to fill one request, from the pack if it has the image
+static void LoadRequest(const Pack* pack, ImageRequest* request) {
+    const PackEntry* entry = PackFind(pack, request->file);
+    float bakedScale = 1.0f;
+
+    if (entry != NULL && entry->type == PACK_PIXELS) {
+        request->image = (Image){
+            .data = (void*)PackEntryData(pack, entry),
+            .width = (int)entry->width,
+            .height = (int)entry->height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8
+        };
+        request->borrowed = true;
+        request->fromPack = true;
+        bakedScale = entry->scale;
+    } else {
+        request->image = LoadImage(request->file);
+        if (request->image.data == NULL) return;
+    }
+
+    // Packed at another size: resize a copy, the mapped pixels are read-only
+    if (request->scale > 0.0f && fabsf(request->scale - bakedScale) > 1e-4f) {
+        if (request->borrowed) {
+            request->image = ImageCopy(request->image);
+            request->borrowed = false;
+        }
+        float factor = request->scale / bakedScale;
+        ImageResize(&request->image, (int)(request->image.width * factor + 0.5f), (int)(request->image.height * factor + 0.5f));
+    }
+}
+
+static void* ImageLoaderWorker(void* arg) {
+    ImageLoader* loader = arg;
+    int index;
+    while ((index = atomic_fetch_add(&loader->next, 1)) < loader->count) {
+        LoadRequest(loader->pack, &loader->requests[index]);
+        if (loader->requests[index].image.data == NULL) atomic_fetch_add(&loader->failed, 1);
+        atomic_fetch_add(&loader->done, 1);
+    }
+    return NULL;
+}
+
+// Function to start loading `requests` on one thread per core (at most one per request)
+void ImageLoaderStart(ImageLoader* loader, const Pack* pack, ImageRequest* requests, int count) {
+    loader->pack = pack;
+    loader->requests = requests;
+    loader->count = count;
+    atomic_init(&loader->next, 0);
+    atomic_init(&loader->done, 0);
+    atomic_init(&loader->failed, 0);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cores < 1 ? 1 : (int)cores;
+    if (threads > count) threads = count;
+    if (threads > ASSET_MAX_THREADS) threads = ASSET_MAX_THREADS;
+
+    loader->threadCount = 0;
+    for (int t = 0; t < threads; t++) {
+        if (pthread_create(&loader->threads[loader->threadCount], NULL, ImageLoaderWorker, loader) == 0) loader->threadCount++;
+    }
+}
+
+// Function to wait for every request; anything no thread got to is loaded
+// here. Returns the number of images that failed to load.
+int ImageLoaderFinish(ImageLoader* loader) {
+    ImageLoaderWorker(loader);
+    for (int t = 0; t < loader->threadCount; t++) pthread_join(loader->threads[t], NULL);
+    return atomic_load(&loader->failed);
+}
+
+void UnloadRequestedImages(ImageRequest* requests, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!requests[i].borrowed) UnloadImage(requests[i].image);
+        requests[i].image = (Image){0};
+    }
+}
+
+static void* AssetLoaderThread(void* arg) {
+    AssetLoader* loader = arg;
+
+    // The music decodes while the workers do the images, whole, in the
+    // 16-bit stereo SongStream plays
+    const PackEntry* musicEntry = loader->musicFile != NULL ? PackFind(loader->pack, loader->musicFile) : NULL;
+    if (musicEntry != NULL) {
+        loader->song = LoadWaveFromMemory(GetFileExtension(loader->musicFile), PackEntryData(loader->pack, musicEntry), (int)musicEntry->size);
+    } else if (loader->musicFile != NULL) {
+        loader->song = LoadWave(loader->musicFile);
+    }
+    if (loader->song.data != NULL) WaveFormat(&loader->song, loader->song.sampleRate, 16, 2);
+
+    loader->failed = ImageLoaderFinish(&loader->images);
+    if (loader->atlasCount > 0) {
+        Image images[ATLAS_MAX_SPRITES];
+        float scales[ATLAS_MAX_SPRITES];
+        int count = loader->atlasCount < ATLAS_MAX_SPRITES ? loader->atlasCount : ATLAS_MAX_SPRITES;
+        for (int i = 0; i < count; i++) {
+            images[i] = loader->requests[i].image;
+            scales[i] = loader->requests[i].scale;
+        }
+        if (!BuildAtlasImage(&loader->atlas, &loader->atlasImage, images, scales, count)) loader->atlasImage = (Image){0};
+    }
+    atomic_store_explicit(&loader->done, true, memory_order_release);
+    return NULL;
+}
+
+// Function to start loading everything the loader was given in the background.
+// Call after InitAudioDevice when there is music. Without a thread it loads
+// here, before returning.
+void AssetLoaderStart(AssetLoader* loader) {
+    atomic_init(&loader->done, false);
+    ImageLoaderStart(&loader->images, loader->pack, loader->requests, loader->count);
+    loader->running = pthread_create(&loader->thread, NULL, AssetLoaderThread, loader) == 0;
+    if (!loader->running) AssetLoaderThread(loader);
+}
+
+// Function to poll the loader; once it returns true the results are the caller's
+bool AssetLoaderDone(AssetLoader* loader) {
+    if (!atomic_load_explicit(&loader->done, memory_order_acquire)) return false;
+    if (loader->running) {
+        pthread_join(loader->thread, NULL);
+        loader->running = false;
+    }
+    return true;
+}
+
+// Function to report the share of images loaded so far, 0 to 1
+float AssetLoaderProgress(AssetLoader* loader) {
+    if (loader->count == 0) return 1.0f;
+    return (float)atomic_load(&loader->images.done) / loader->count;
+}
+
+// Function to release the CPU copies once they are uploaded, waiting for the loader if needed
+void AssetLoaderUnloadImages(AssetLoader* loader) {
+    if (loader->running) {
+        pthread_join(loader->thread, NULL);
+        loader->running = false;
+    }
+    UnloadRequestedImages(loader->requests, loader->count);
+    UnloadImage(loader->atlasImage);
+    loader->atlasImage = (Image){0};
+}
+
+// Function to allocate the texture for `image` without uploading any pixels yet
+void TextureUploadBegin(TextureUpload* upload, Image image) {
+    *upload = (TextureUpload){ .image = image };
+    if (image.data == NULL) return;
+    upload->texture = (Texture2D){
+        .id = rlLoadTexture(NULL, image.width, image.height, image.format, 1),
+        .width = image.width,
+        .height = image.height,
+        .mipmaps = 1,
+        .format = image.format
+    };
+}
+
+// Function to upload bands of rows until the texture is complete or the
+// GetTime() deadline passes; at least one band goes up per call. True once
+// complete, or when there is nothing to upload.
+bool TextureUploadStep(TextureUpload* upload, double deadline) {
+    if (upload->texture.id == 0) return true;
+    int rowBytes = GetPixelDataSize(upload->image.width, 1, upload->image.format);
+    int bandRows = rowBytes > 0 && UPLOAD_BAND_BYTES / rowBytes > 0 ? UPLOAD_BAND_BYTES / rowBytes : 1;
+
+    do {
+        if (upload->rows >= upload->image.height) return true;
+        int rows = upload->image.height - upload->rows < bandRows ? upload->image.height - upload->rows : bandRows;
+        Rectangle band = { 0, (float)upload->rows, (float)upload->image.width, (float)rows };
+        UpdateTextureRec(upload->texture, band, (const unsigned char*)upload->image.data + (size_t)upload->rows * rowBytes);
+        upload->rows += rows;
+    } while (GetTime() < deadline);
+    return upload->rows >= upload->image.height;
+}
@@ -0,0 +1,77 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "raylib.h"
+#include "pack.h"
+#include "atlas.h"
+
+// Startup loading. Worker threads take images from the pack, where they are
+// already decoded, or decode the loose files when there is no pack, and
+// scale them. AssetLoader runs that, the atlas build and the music decode on
+// a background thread so the caller keeps drawing frames. Texture uploads
+// stay with the caller, which owns the GL context; TextureUpload spreads
+// them over frames a band of rows at a time.
+
+#define ASSET_MAX_THREADS 8
+#define UPLOAD_BAND_BYTES (512 * 1024) // Pixels per UpdateTexture call
+
+typedef struct {
+    const char* file; // Loose file name, also the asset's name in the pack
+    float scale;      // Wanted size relative to the source image, 0 to take it as stored
+    Image image;      // Result, at `scale` if one was asked for; data NULL if loading failed
+    bool borrowed;    // image.data points into the pack: never unload it
+    bool fromPack;
+} ImageRequest;
+
+typedef struct {
+    const Pack* pack; // NULL: loose files only
+    ImageRequest* requests;
+    int count;
+    atomic_int next;  // Next request to claim
+    atomic_int done;  // Requests finished, for progress bars
+    atomic_int failed;
+    pthread_t threads[ASSET_MAX_THREADS];
+    int threadCount;
+} ImageLoader;
+
+void ImageLoaderStart(ImageLoader* loader, const Pack* pack, ImageRequest* requests, int count);
+int ImageLoaderFinish(ImageLoader* loader);
+void UnloadRequestedImages(ImageRequest* requests, int count);
+
+typedef struct {
+    // Filled in by the caller before AssetLoaderStart
+    const Pack* pack;       // NULL: loose files only
+    ImageRequest* requests;
+    int count;
+    int atlasCount;         // The first atlasCount requests are packed into `atlas`, 0 for none
+    const char* musicFile;  // NULL for no music
+    // Results, valid once AssetLoaderDone returns true
+    Atlas atlas;            // Sprites laid out, texture not uploaded yet
+    Image atlasImage;
+    Wave song;              // Decoded music, the caller's to keep or unload
+    int failed;             // Images that did not load
+    // Internal
+    ImageLoader images;
+    pthread_t thread;
+    bool running;
+    atomic_bool done;
+} AssetLoader;
+
+void AssetLoaderStart(AssetLoader* loader);
+bool AssetLoaderDone(AssetLoader* loader);
+float AssetLoaderProgress(AssetLoader* loader);
+void AssetLoaderUnloadImages(AssetLoader* loader);
+
+// One texture uploaded over several frames
+typedef struct {
+    Image image;       // Source pixels, kept by the caller until the upload completes
+    Texture2D texture; // Allocated by TextureUploadBegin, filled in bands
+    int rows;          // Rows uploaded so far
+} TextureUpload;
+
+void TextureUploadBegin(TextureUpload* upload, Image image);
+bool TextureUploadStep(TextureUpload* upload, double deadline);
+
+#endif
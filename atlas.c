@@ -0,0 +1,101 @@
+#include "atlas.h"
+#include "rlgl.h"
+#include <stdlib.h>
+
+static rlRenderBatch countedBatch;
+static bool countedBatchLoaded = false;
+
+// Function to sort sprite indices tallest first, the order the shelf packer wants
+static const Image* sortImages;
+static int CompareHeight(const void* a, const void* b) {
+    return sortImages[*(const int*)b].height - sortImages[*(const int*)a].height;
+}
+
+// Function to pack images, already scaled to their draw size, into one
+// image. Rows ("shelves") are filled left to right with the tallest images
+// first; the atlas is as tall as its shelves need. CPU only, so any thread
+// can call it; `atlas` is complete once its texture is set.
+bool BuildAtlasImage(Atlas* atlas, Image* packed, const Image* images, const float* scales, int count) {
+    *atlas = (Atlas){0};
+    if (count > ATLAS_MAX_SPRITES) return false;
+
+    int order[ATLAS_MAX_SPRITES];
+    for (int i = 0; i < count; i++) {
+        if (images[i].data == NULL || images[i].width + ATLAS_PADDING > ATLAS_WIDTH) return false;
+        order[i] = i;
+    }
+    sortImages = images;
+    qsort(order, count, sizeof(int), CompareHeight);
+
+    int x = 0, y = 0, shelfHeight = 0;
+    for (int n = 0; n < count; n++) {
+        const Image* image = &images[order[n]];
+        if (x + image->width + ATLAS_PADDING > ATLAS_WIDTH) {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        atlas->sprites[order[n]] = (AtlasSprite){
+            .source = { (float)x, (float)y, (float)image->width, (float)image->height },
+            .scale = scales[order[n]]
+        };
+        x += image->width + ATLAS_PADDING;
+        if (image->height + ATLAS_PADDING > shelfHeight) shelfHeight = image->height + ATLAS_PADDING;
+    }
+
+    *packed = GenImageColor(ATLAS_WIDTH, y + shelfHeight, BLANK);
+    for (int i = 0; i < count; i++) {
+        Rectangle whole = { 0, 0, (float)images[i].width, (float)images[i].height };
+        ImageDraw(packed, images[i], whole, atlas->sprites[i].source, WHITE);
+    }
+    atlas->count = count;
+    return true;
+}
+
+// Function to build the atlas and upload it in one go
+bool LoadAtlas(Atlas* atlas, const Image* images, const float* scales, int count) {
+    Image packed;
+    if (!BuildAtlasImage(atlas, &packed, images, scales, count)) return false;
+    atlas->texture = LoadTextureFromImage(packed);
+    UnloadImage(packed);
+    return atlas->texture.id != 0;
+}
+
+void UnloadAtlas(Atlas* atlas) {
+    UnloadTexture(atlas->texture);
+    *atlas = (Atlas){0};
+}
+
+// Function to draw a sprite centred on `center`; `scale` is relative to the source image, as with DrawTextureEx
+void DrawSprite(const Atlas* atlas, int sprite, Vector2 center, float scale, Color tint) {
+    const AtlasSprite* entry = &atlas->sprites[sprite];
+    float width = entry->source.width * scale / entry->scale;
+    float height = entry->source.height * scale / entry->scale;
+    Rectangle dest = { center.x - width / 2, center.y - height / 2, width, height };
+    DrawTexturePro(atlas->texture, entry->source, dest, (Vector2){ 0, 0 }, 0.0f, tint);
+}
+
+// Function to route rlgl through a batch we can read; call after InitWindow
+void DrawCallCounterInit(void) {
+    countedBatch = rlLoadRenderBatch(RL_DEFAULT_BATCH_BUFFERS, RL_DEFAULT_BATCH_BUFFER_ELEMENTS);
+    rlSetRenderBatchActive(&countedBatch);
+    countedBatchLoaded = true;
+}
+
+// Function to count the draw calls queued so far; empty entries are never issued
+int DrawCallCount(void) {
+    if (!countedBatchLoaded) return 0;
+    int calls = 0;
+    for (int i = 0; i < countedBatch.drawCounter; i++) {
+        if (countedBatch.draws[i].vertexCount > 0) calls++;
+    }
+    return calls;
+}
+
+// Function to hand rendering back to rlgl's own batch; call before CloseWindow
+void DrawCallCounterClose(void) {
+    if (!countedBatchLoaded) return;
+    rlSetRenderBatchActive(NULL);
+    rlUnloadRenderBatch(countedBatch);
+    countedBatchLoaded = false;
+}
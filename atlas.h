@@ -0,0 +1,38 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include "raylib.h"
+
+// Sprite atlas: images are scaled to the size they are drawn at and packed
+// into one texture at load time, so consecutive sprite draws share a texture
+// and raylib batches them into a single draw call.
+
+#define ATLAS_MAX_SPRITES 32
+#define ATLAS_WIDTH 2048
+#define ATLAS_PADDING 2 // Transparent pixels between sprites, so filtering never bleeds
+
+typedef struct {
+    Rectangle source; // Where the sprite sits in the atlas
+    float scale;      // Scale the source image was baked at
+} AtlasSprite;
+
+typedef struct {
+    Texture2D texture;
+    AtlasSprite sprites[ATLAS_MAX_SPRITES];
+    int count;
+} Atlas;
+
+// Sprites are numbered in `images` order; each image is already at scales[i]
+bool LoadAtlas(Atlas* atlas, const Image* images, const float* scales, int count);
+bool BuildAtlasImage(Atlas* atlas, Image* packed, const Image* images, const float* scales, int count);
+void UnloadAtlas(Atlas* atlas);
+void DrawSprite(const Atlas* atlas, int sprite, Vector2 center, float scale, Color tint);
+
+// Draw-call counting: rlgl only keeps its count in the render batch, so these
+// install a batch of our own and read it. Calls since the last batch flush,
+// which is the whole frame up to EndDrawing unless a render texture intervened.
+void DrawCallCounterInit(void);
+int DrawCallCount(void);
+void DrawCallCounterClose(void);
+
+#endif
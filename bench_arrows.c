@@ -0,0 +1,165 @@
+#include "arrow_ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Microbenchmark: shifting Player.arrows array vs ArrowRing.
+// Capacity is MAX_ARROWS; build with -DMAX_ARROWS=1000 for the 10x run.
+
+#define FRAME_DT (1.0f / 60.0f)
+#define SPEED 300.0f
+#define SPAWN_Y -50.0f
+#define LIMIT_Y 720.0f
+#define BURST_FRAMES 20     // Arrows spawn in bursts so many expire on the same frame
+#define HIT_FRACTION 2        // One in this many spawned arrows is hit before it expires
+#define FRAMES 200000
+
+// Arrows here still move every frame, as they did before the game placed
+// them from their hit time, so each one carries its y
+typedef struct {
+    Arrow arrow;
+    float y;
+} MovingArrow;
+
+// The layout Player used before the ring: a packed array with shifting removal
+typedef struct {
+    MovingArrow arrows[MAX_ARROWS];
+    int arrowCount;
+} ShiftArray;
+
+// The ring, with each slot's y alongside
+typedef struct {
+    ArrowRing ring;
+    float y[MAX_ARROWS];
+} MovingRing;
+
+static void ShiftRemove(ShiftArray* a, int index) {
+    if (index < 0 || index >= a->arrowCount) return;
+    for (int i = index; i < a->arrowCount - 1; i++) {
+        a->arrows[i] = a->arrows[i + 1];
+    }
+    a->arrowCount--;
+}
+
+static void ShiftSpawn(ShiftArray* a, int direction) {
+    if (a->arrowCount >= MAX_ARROWS) return;
+    MovingArrow* moving = &a->arrows[a->arrowCount++];
+    moving->arrow.x = 0.0f;
+    moving->arrow.direction = direction;
+    moving->arrow.active = true;
+    moving->y = SPAWN_Y;
+}
+
+static void RingSpawn(MovingRing* m, int direction) {
+    Arrow* arrow = ArrowRingPush(&m->ring);
+    if (arrow == NULL) return;
+    arrow->x = 0.0f;
+    arrow->direction = direction;
+    m->y[arrow - m->ring.arrows] = SPAWN_Y;
+}
+
+// Function to move every arrow down by dy, walking the two contiguous spans
+static void RingMove(MovingRing* m, float dy) {
+    const ArrowRing* r = &m->ring;
+    int firstSpan = r->count < MAX_ARROWS - r->head ? r->count : MAX_ARROWS - r->head;
+    for (int i = r->head; i < r->head + firstSpan; i++) m->y[i] += dy;
+    for (int i = 0; i < r->count - firstSpan; i++) m->y[i] += dy;
+}
+
+// Function to expire arrows from the head once they pass below limitY
+static void RingExpire(MovingRing* m, float limitY) {
+    ArrowRing* r = &m->ring;
+    while (r->count > 0 && m->y[r->head] > limitY) {
+        r->arrows[r->head].active = false;
+        ArrowRingTrim(r);
+    }
+}
+
+// Function to find the k-th active arrow from the oldest, skipping the holes hits leave
+static int RingActiveIndex(ArrowRing* r, int k) {
+    for (int i = 0; i < r->count; i++) {
+        if (ArrowRingAt(r, i)->active && k-- == 0) return i;
+    }
+    return -1;
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Arrows live (LIMIT_Y - SPAWN_Y) / SPEED seconds; size the bursts to keep the container near full
+static int BurstSize(void) {
+    float lifeFrames = (LIMIT_Y - SPAWN_Y) / SPEED / FRAME_DT;
+    int burst = (int)(MAX_ARROWS * BURST_FRAMES / lifeFrames);
+    return burst > 0 ? burst : 1;
+}
+
+static double BenchShift(long* checksum) {
+    static ShiftArray a;
+    a.arrowCount = 0;
+    int burst = BurstSize();
+    srand(1);
+
+    double start = NowSeconds();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        if (frame % BURST_FRAMES == 0) {
+            for (int i = 0; i < burst; i++) ShiftSpawn(&a, rand() % 4);
+        }
+        if (frame % BURST_FRAMES == BURST_FRAMES / 2) {
+            for (int h = 0; h < burst / HIT_FRACTION && a.arrowCount > 0; h++) {
+                ShiftRemove(&a, rand() % a.arrowCount);
+            }
+        }
+        for (int i = 0; i < a.arrowCount; i++) {
+            a.arrows[i].y += SPEED * FRAME_DT;
+            if (a.arrows[i].y > LIMIT_Y) {
+                ShiftRemove(&a, i);
+                i--;
+            }
+        }
+        *checksum += a.arrowCount;
+    }
+    return NowSeconds() - start;
+}
+
+static double BenchRing(long* checksum) {
+    static MovingRing m;
+    ArrowRing* r = &m.ring;
+    ArrowRingClear(r);
+    int burst = BurstSize();
+    srand(1);
+
+    double start = NowSeconds();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        if (frame % BURST_FRAMES == 0) {
+            for (int i = 0; i < burst; i++) RingSpawn(&m, rand() % 4);
+        }
+        if (frame % BURST_FRAMES == BURST_FRAMES / 2) {
+            // Hit a random live arrow, as the shift array does
+            int active = 0;
+            for (int i = 0; i < r->count; i++) active += ArrowRingAt(r, i)->active;
+            for (int h = 0; h < burst / HIT_FRACTION && active > 0; h++, active--) {
+                ArrowRingRemove(r, RingActiveIndex(r, rand() % active));
+            }
+        }
+        RingMove(&m, SPEED * FRAME_DT);
+        RingExpire(&m, LIMIT_Y);
+        *checksum += r->count;
+    }
+    return NowSeconds() - start;
+}
+
+int main(void) {
+    long shiftSum = 0, ringSum = 0;
+    double shiftTime = BenchShift(&shiftSum);
+    double ringTime = BenchRing(&ringSum);
+
+    printf("capacity %d, burst %d every %d frames, %d frames\n", MAX_ARROWS, BurstSize(), BURST_FRAMES, FRAMES);
+    printf("shift array: %8.1f ns/frame (avg occupancy %.1f)\n", shiftTime * 1e9 / FRAMES, (double)shiftSum / FRAMES);
+    printf("arrow ring:  %8.1f ns/frame (avg slots %.1f)\n", ringTime * 1e9 / FRAMES, (double)ringSum / FRAMES);
+    printf("speedup:     %.2fx\n", shiftTime / ringTime);
+
+    return 0;
+}
@@ -0,0 +1,298 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+// Reliability layer for the UDP transport, shared by server.c, client.c and loadgen.c.
+//
+// A datagram is a PacketHeader followed by protocol.h messages back to back:
+// the reliable ones first, then the unreliable ones. Reliable messages (ID,
+// READY, START, INPUT, JUDGMENT) are numbered and repeated in every packet
+// until the peer acknowledges them, so a lost packet costs nothing once a
+// later one gets through, and each new input rides along with every earlier
+// unacknowledged one. They are delivered in order, and always before the
+// unreliable messages of the same packet. A packet only carries unreliable
+// messages when it carries every pending reliable one too, so a snapshot is
+// never applied ahead of a judgment the server sent before it. Unreliable
+// messages (SNAPSHOT, PING, PONG) are never queued for resending, and are
+// dropped when they arrive after a newer packet. Nothing waits for a lost
+// packet: there is no head-of-line blocking between unrelated updates.
+//
+// A client's first packets (hellos) go to the server's lobby, which answers
+// with lobby packets until an opponent arrives. The match's channel then
+// talks from the address of the worker that owns the room, and the client
+// sends there from its first packet on.
+
+#include <stdbool.h>
+#include "protocol.h"
+
+#define CHANNEL_PACKET_SIZE 1200  // Stays under the path MTU
+#define CHANNEL_PENDING_SIZE 2048 // Bytes of reliable messages waiting for an ack
+#define CHANNEL_MAX_MESSAGES 128  // Messages one ChannelRead can hand back
+#define CHANNEL_HISTORY 64        // Sent packets remembered for acks and round trips, a power of two
+#define CHANNEL_RESEND_MS 30      // Unacked reliable messages and owed acks go out at least this often
+#define CHANNEL_KEEPALIVE_MS 250  // An idle client still sends this often
+#define CHANNEL_TIMEOUT_MS 5000   // Silence after which the peer is gone
+
+#define CHANNEL_FLAG_ACKS 1  // ack and ackBits are valid: the sender has heard from us
+#define CHANNEL_FLAG_LOBBY 2 // From the lobby: only its messages count, it is no part of the channel
+
+#pragma pack(push, 1)
+
+typedef struct {
+    uint8_t version;        // PROTO_VERSION
+    uint8_t flags;
+    uint32_t session;       // Picked by the client and echoed back: a new connection from a reused address is told apart
+    uint16_t sequence;      // Packet number
+    uint16_t ack;           // Newest packet number received from the peer
+    uint32_t ackBits;       // Bit i set: packet ack - 1 - i arrived as well
+    uint16_t reliableFirst; // Number of the first reliable message in this packet
+    uint8_t reliableCount;  // Reliable messages right after the header
+    uint16_t reliableAck;   // Every reliable message numbered before this has been delivered
+} PacketHeader;
+
+#pragma pack(pop)
+
+typedef struct {
+    long packetsSent;
+    long packetsReceived;
+    long packetsAcked;
+    long stale;     // Packets that arrived after a newer one
+    long resent;    // Reliable messages repeated in a later packet
+    long overflows; // Reliable messages refused because the pending buffer was full
+    double rttMs;   // Smoothed round trip of acked packets
+} ChannelStats;
+
+typedef struct {
+    uint32_t session;
+
+    // Sending
+    uint16_t sequence;      // Number of the next packet
+    uint16_t reliableNext;  // Number the next queued reliable message gets
+    uint16_t reliableAcked; // The peer has every reliable message before this
+    uint16_t reliableSent;  // Every reliable message before this went out at least once
+    uint8_t pending[CHANNEL_PENDING_SIZE]; // Unacked reliable messages, oldest first, numbered from reliableAcked
+    size_t pendingLen;
+    uint64_t sentNs[CHANNEL_HISTORY];      // By sequence, 0 once acked
+
+    // Receiving
+    bool heard;             // A packet has arrived
+    uint16_t remoteSequence; // Newest packet number from the peer
+    uint32_t remoteBits;     // Earlier packets that arrived, as in ackBits
+    uint16_t reliableExpected; // Number of the next reliable message to deliver
+    bool ackOwed;           // Something arrived since our last packet
+
+    ChannelStats stats;
+} Channel;
+
+// Function to compare wrapping 16-bit numbers: true when a comes after b
+static inline bool ChannelAfter(uint16_t a, uint16_t b) {
+    return (int16_t)(a - b) > 0;
+}
+
+// Snapshots are latest-wins and pings measure the link itself; everything else must arrive
+static inline bool ChannelReliable(uint8_t type) {
+    return type != MSG_SNAPSHOT && type != MSG_PING && type != MSG_PONG;
+}
+
+static inline void ChannelInit(Channel* channel, uint32_t session) {
+    memset(channel, 0, sizeof(*channel));
+    channel->session = session;
+}
+
+// Function to queue a reliable message, false when the peer is too far behind to take it
+static inline bool ChannelSend(Channel* channel, const Message* msg) {
+    size_t len = msg->header.length;
+    if (channel->pendingLen + len > CHANNEL_PENDING_SIZE) {
+        channel->stats.overflows++;
+        return false;
+    }
+    memcpy(channel->pending + channel->pendingLen, msg, len);
+    channel->pendingLen += len;
+    channel->reliableNext++;
+    return true;
+}
+
+// Function to give up on every queued reliable message, for a peer being dropped
+static inline void ChannelDiscard(Channel* channel) {
+    channel->pendingLen = 0;
+    channel->reliableAcked = channel->reliableSent = channel->reliableNext;
+}
+
+// True while reliable messages wait for an ack
+static inline bool ChannelPending(const Channel* channel) {
+    return channel->pendingLen > 0;
+}
+
+// True when reliable messages were queued since the last packet
+static inline bool ChannelUnsent(const Channel* channel) {
+    return channel->reliableSent != channel->reliableNext;
+}
+
+// True once the packet with this number is known to have arrived
+static inline bool ChannelDelivered(const Channel* channel, uint16_t sequence) {
+    uint16_t age = (uint16_t)(channel->sequence - sequence);
+    return age >= 1 && age <= CHANNEL_HISTORY && channel->sentNs[sequence % CHANNEL_HISTORY] == 0;
+}
+
+// Function to look at a packet before it has a channel: false when it is not
+// one of ours. A hello comes from a peer that has not heard from us yet and
+// has sent nothing reliable; only a hello may open a connection.
+static inline bool ChannelPeek(const uint8_t* data, size_t len, uint32_t* session, bool* hello) {
+    PacketHeader header;
+    if (len < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != PROTO_VERSION) return false;
+    *session = header.session;
+    *hello = !(header.flags & CHANNEL_FLAG_ACKS) && header.reliableFirst == 0;
+    return true;
+}
+
+// Function to build a lobby packet carrying `msg` for the client with this session
+static inline size_t ChannelWriteLobby(uint8_t* packet, uint32_t session, const Message* msg) {
+    PacketHeader header = { .version = PROTO_VERSION, .flags = CHANNEL_FLAG_LOBBY, .session = session };
+    memcpy(packet, &header, sizeof(header));
+    memcpy(packet + sizeof(header), msg, msg->header.length);
+    return sizeof(header) + msg->header.length;
+}
+
+// Function to build the next packet into `packet` (CHANNEL_PACKET_SIZE bytes):
+// every pending reliable message that fits, then `unreliable` if all of them
+// did. Returns the packet length; *unreliableSent says whether they went.
+static inline size_t ChannelWrite(Channel* channel, uint8_t* packet, const Message* unreliable, int unreliableCount,
+                                  bool* unreliableSent, uint64_t nowNs) {
+    PacketHeader header = {
+        .version = PROTO_VERSION,
+        .flags = channel->heard ? CHANNEL_FLAG_ACKS : 0,
+        .session = channel->session,
+        .sequence = channel->sequence,
+        .ack = channel->remoteSequence,
+        .ackBits = channel->remoteBits,
+        .reliableFirst = channel->reliableAcked,
+        .reliableAck = channel->reliableExpected
+    };
+    size_t len = sizeof(header);
+
+    size_t offset = 0;
+    uint16_t number = channel->reliableAcked;
+    while (offset < channel->pendingLen && header.reliableCount < UINT8_MAX) {
+        MsgHeader msg;
+        memcpy(&msg, channel->pending + offset, sizeof(msg));
+        if (len + msg.length > CHANNEL_PACKET_SIZE) break;
+        memcpy(packet + len, channel->pending + offset, msg.length);
+        len += msg.length;
+        offset += msg.length;
+        if (ChannelAfter(channel->reliableSent, number)) channel->stats.resent++;
+        number++;
+        header.reliableCount++;
+    }
+    if (ChannelAfter(number, channel->reliableSent)) channel->reliableSent = number;
+
+    bool sent = offset == channel->pendingLen;
+    for (int i = 0; sent && i < unreliableCount; i++) {
+        size_t size = unreliable[i].header.length;
+        if (len + size > CHANNEL_PACKET_SIZE) {
+            sent = false;
+            break;
+        }
+        memcpy(packet + len, &unreliable[i], size);
+        len += size;
+    }
+    if (unreliableSent != NULL) *unreliableSent = sent;
+
+    memcpy(packet, &header, sizeof(header));
+    channel->sentNs[channel->sequence % CHANNEL_HISTORY] = nowNs;
+    channel->sequence++;
+    channel->ackOwed = false;
+    channel->stats.packetsSent++;
+    return len;
+}
+
+// Function to note that the peer received one of our packets
+static inline void ChannelAcked(Channel* channel, uint16_t sequence, uint64_t nowNs) {
+    uint16_t age = (uint16_t)(channel->sequence - sequence);
+    uint64_t* sent = &channel->sentNs[sequence % CHANNEL_HISTORY];
+    if (age < 1 || age > CHANNEL_HISTORY || *sent == 0) return;
+
+    double rttMs = (nowNs - *sent) / 1e6;
+    channel->stats.rttMs = channel->stats.packetsAcked == 0 ? rttMs : channel->stats.rttMs + 0.1 * (rttMs - channel->stats.rttMs);
+    channel->stats.packetsAcked++;
+    *sent = 0;
+}
+
+// Function to apply a received packet's acks and number; true when it is the
+// newest packet from the peer so far
+static inline bool ChannelTakeHeader(Channel* channel, const PacketHeader* packet, uint64_t nowNs) {
+    PacketHeader header = *packet;
+    if (header.flags & CHANNEL_FLAG_ACKS) {
+        ChannelAcked(channel, header.ack, nowNs);
+        for (int i = 0; i < 32; i++) {
+            if (header.ackBits & (1u << i)) ChannelAcked(channel, (uint16_t)(header.ack - 1 - i), nowNs);
+        }
+    }
+
+    // Drop the reliable messages the peer now has from the front of the pending buffer
+    if (ChannelAfter(header.reliableAck, channel->reliableAcked) && !ChannelAfter(header.reliableAck, channel->reliableNext)) {
+        size_t offset = 0;
+        while (channel->reliableAcked != header.reliableAck) {
+            MsgHeader msg;
+            memcpy(&msg, channel->pending + offset, sizeof(msg));
+            offset += msg.length;
+            channel->reliableAcked++;
+        }
+        memmove(channel->pending, channel->pending + offset, channel->pendingLen - offset);
+        channel->pendingLen -= offset;
+        if (ChannelAfter(channel->reliableAcked, channel->reliableSent)) channel->reliableSent = channel->reliableAcked;
+    }
+
+    // Only the newest packet's unreliable messages are current
+    bool fresh = !channel->heard || ChannelAfter(header.sequence, channel->remoteSequence);
+    if (fresh) {
+        uint16_t gap = (uint16_t)(header.sequence - channel->remoteSequence);
+        if (!channel->heard || gap > 32) channel->remoteBits = 0;
+        else channel->remoteBits = (gap == 32 ? 0 : channel->remoteBits << gap) | (1u << (gap - 1));
+        channel->remoteSequence = header.sequence;
+        channel->heard = true;
+    } else {
+        uint16_t age = (uint16_t)(channel->remoteSequence - header.sequence);
+        if (age >= 1 && age <= 32) channel->remoteBits |= 1u << (age - 1);
+        channel->stats.stale++;
+    }
+    channel->ackOwed = true;
+    channel->stats.packetsReceived++;
+    return fresh;
+}
+
+// Function to take in a received packet: applies its acks and copies the
+// messages to deliver into `out`, reliable ones in order first. Returns how
+// many, or -1 when the datagram is not a packet of this connection.
+static inline int ChannelRead(Channel* channel, const uint8_t* data, size_t len, uint64_t nowNs, Message* out, int max) {
+    PacketHeader header;
+    if (len < sizeof(header)) return -1;
+    memcpy(&header, data, sizeof(header));
+    if (header.version != PROTO_VERSION || header.session != channel->session) return -1;
+
+    bool fresh = true;
+    if (header.flags & CHANNEL_FLAG_LOBBY) header.reliableCount = 0;
+    else fresh = ChannelTakeHeader(channel, &header, nowNs);
+
+    int count = 0;
+    size_t offset = sizeof(header);
+    uint16_t number = header.reliableFirst;
+    for (int i = 0; i < header.reliableCount + (fresh ? CHANNEL_MAX_MESSAGES : 0); i++) {
+        bool reliable = i < header.reliableCount;
+        if (len - offset < sizeof(MsgHeader)) break;
+        MsgHeader msg;
+        memcpy(&msg, data + offset, sizeof(msg));
+        if (msg.version != PROTO_VERSION || msg.length < sizeof(MsgHeader) || msg.length > len - offset) break;
+
+        // Reliable messages already delivered come around again until our ack gets through
+        bool deliver = !reliable || number == channel->reliableExpected;
+        if (deliver && count == max) break;  // The rest comes again in a later packet
+        if (deliver && msg.length == ProtoMessageSize(msg.type)) memcpy(&out[count++], data + offset, msg.length);
+        if (reliable && number == channel->reliableExpected) channel->reliableExpected++;
+        if (reliable) number++;
+        offset += msg.length;
+    }
+    return count;
+}
+
+#endif
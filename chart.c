@@ -0,0 +1,90 @@
+#include "chart.h"
+#include "mapfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Function to check that an array of `count` items of `size` bytes at `offset` lies inside the data
+static bool ChartRangeValid(size_t dataSize, uint32_t offset, uint32_t count, size_t size) {
+    if (offset % 4 != 0 || offset > dataSize) return false;
+    return (uint64_t)count * size <= dataSize - offset;
+}
+
+// Function to point a chart at data already in memory. Only the header and
+// array bounds are checked, so this is O(1) in the number of notes.
+bool ChartFromMemory(Chart* chart, const void* data, size_t size) {
+    memset(chart, 0, sizeof(*chart));
+    if (size < sizeof(ChartHeader)) return false;
+
+    const ChartHeader* header = data;
+    if (memcmp(header->magic, CHART_MAGIC, 4) != 0) return false;
+    if (header->version != CHART_VERSION || header->lanes != CHART_LANES) return false;
+    if (!ChartRangeValid(size, header->tempoOffset, header->tempoCount, sizeof(ChartTempo))) return false;
+    for (int lane = 0; lane < CHART_LANES; lane++) {
+        if (!ChartRangeValid(size, header->noteOffset[lane], header->noteCount[lane], sizeof(ChartNote))) return false;
+    }
+
+    chart->data = data;
+    chart->size = size;
+    chart->header = header;
+    chart->tempos = (const ChartTempo*)(chart->data + header->tempoOffset);
+    for (int lane = 0; lane < CHART_LANES; lane++) {
+        chart->notes[lane] = (const ChartNote*)(chart->data + header->noteOffset[lane]);
+    }
+    return true;
+}
+
+// Function to map a chart file read-only; pages come in as the cursor reaches them
+bool ChartOpen(Chart* chart, const char* path) {
+    MappedFile file;
+    if (!MapFile(&file, path)) {
+        memset(chart, 0, sizeof(*chart));
+        return false;
+    }
+    if (!ChartFromMemory(chart, file.data, file.size)) {
+        UnmapFile(&file);
+        return false;
+    }
+    chart->owned = true;
+    return true;
+}
+
+// Function to release a chart; data handed to ChartFromMemory stays the caller's
+void ChartClose(Chart* chart) {
+    if (chart->owned) {
+        MappedFile file = { chart->data, chart->size };
+        UnmapFile(&file);
+    }
+    memset(chart, 0, sizeof(*chart));
+}
+
+// Function to write a chart file; each lane's notes must already be sorted by time
+bool ChartSave(const char* path, const ChartTempo* tempos, uint32_t tempoCount,
+               const ChartNote* const notes[CHART_LANES], const uint32_t noteCount[CHART_LANES]) {
+    ChartHeader header = {0};
+    memcpy(header.magic, CHART_MAGIC, 4);
+    header.version = CHART_VERSION;
+    header.lanes = CHART_LANES;
+    header.tempoCount = tempoCount;
+    header.tempoOffset = sizeof(ChartHeader);
+
+    uint32_t offset = header.tempoOffset + tempoCount * sizeof(ChartTempo);
+    for (int lane = 0; lane < CHART_LANES; lane++) {
+        header.noteCount[lane] = noteCount[lane];
+        header.noteOffset[lane] = offset;
+        offset += noteCount[lane] * sizeof(ChartNote);
+        if (noteCount[lane] > 0 && notes[lane][noteCount[lane] - 1].timeUs > header.lengthUs) {
+            header.lengthUs = notes[lane][noteCount[lane] - 1].timeUs;
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(tempos, sizeof(ChartTempo), tempoCount, file) == tempoCount;
+    for (int lane = 0; lane < CHART_LANES; lane++) {
+        ok = ok && fwrite(notes[lane], sizeof(ChartNote), noteCount[lane], file) == noteCount[lane];
+    }
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
@@ -0,0 +1,54 @@
+#ifndef CHART_H
+#define CHART_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary note chart. The file is mapped as is and used in place: a header,
+// the tempo map, then one array of notes per lane sorted by time. All fields
+// are little-endian and 4-byte aligned, so opening a chart costs the same
+// whatever its length and allocates nothing per note.
+
+#define CHART_MAGIC "DCHT"
+#define CHART_VERSION 1
+#define CHART_LANES 4 // Same numbering as Arrow.direction
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t lanes;                    // CHART_LANES
+    uint32_t lengthUs;                 // Time of the last note
+    uint32_t tempoCount;
+    uint32_t tempoOffset;              // Byte offset of ChartTempo[tempoCount]
+    uint32_t noteCount[CHART_LANES];
+    uint32_t noteOffset[CHART_LANES];  // Byte offset of each lane's ChartNote[noteCount]
+} ChartHeader;
+
+// Tempo change: from `beat` on, the song runs at `bpm`
+typedef struct {
+    uint32_t timeUs;
+    float beat;
+    float bpm;
+} ChartTempo;
+
+typedef struct {
+    uint32_t timeUs; // When the note crosses the target line, from song start
+} ChartNote;
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    bool owned;  // Opened by ChartOpen, so ChartClose releases the data
+    const ChartHeader* header;
+    const ChartTempo* tempos;
+    const ChartNote* notes[CHART_LANES];
+} Chart;
+
+bool ChartOpen(Chart* chart, const char* path);
+bool ChartFromMemory(Chart* chart, const void* data, size_t size);
+void ChartClose(Chart* chart);
+bool ChartSave(const char* path, const ChartTempo* tempos, uint32_t tempoCount,
+               const ChartNote* const notes[CHART_LANES], const uint32_t noteCount[CHART_LANES]);
+
+#endif
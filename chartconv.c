@@ -0,0 +1,161 @@
+#include "chart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// Converts a text chart into the binary format read by chart.c.
+//
+// Text format, one statement per line, '#' starts a comment:
+//   offset <seconds>      song time of beat 0 (default 0)
+//   tempo <beat> <bpm>    from this beat on the song runs at bpm; the first must be at beat 0
+//   note <beat> <lane>    lane is up, down, left, right or 0-3
+// Beats may be fractional, so "note 12.5 left" is the off-beat after beat 12.
+
+#define MAX_LINE 256
+
+typedef struct {
+    double beat;
+    double bpm;
+} TextTempo;
+
+typedef struct {
+    void* items;
+    size_t count;
+    size_t capacity;
+} Array;
+
+static void* ArrayPush(Array* array, size_t itemSize) {
+    if (array->count == array->capacity) {
+        array->capacity = array->capacity ? array->capacity * 2 : 64;
+        array->items = realloc(array->items, array->capacity * itemSize);
+        if (array->items == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    return (char*)array->items + itemSize * array->count++;
+}
+
+static int ParseLane(const char* name) {
+    static const char* names[CHART_LANES] = { "up", "down", "left", "right" };
+    for (int lane = 0; lane < CHART_LANES; lane++) {
+        if (strcasecmp(name, names[lane]) == 0) return lane;
+    }
+    if (name[0] >= '0' && name[0] < '0' + CHART_LANES && name[1] == '\0') return name[0] - '0';
+    return -1;
+}
+
+static int CompareTempo(const void* a, const void* b) {
+    double x = ((const TextTempo*)a)->beat, y = ((const TextTempo*)b)->beat;
+    return (x > y) - (x < y);
+}
+
+static int CompareNote(const void* a, const void* b) {
+    uint32_t x = ((const ChartNote*)a)->timeUs, y = ((const ChartNote*)b)->timeUs;
+    return (x > y) - (x < y);
+}
+
+// Function to turn a beat position into song time by walking the tempo map
+static double BeatToSeconds(const TextTempo* tempos, size_t count, double offset, double beat) {
+    double seconds = offset;
+    for (size_t i = 0; i < count; i++) {
+        double end = i + 1 < count && tempos[i + 1].beat < beat ? tempos[i + 1].beat : beat;
+        if (end <= tempos[i].beat) break;
+        seconds += (end - tempos[i].beat) * 60.0 / tempos[i].bpm;
+    }
+    return seconds;
+}
+
+static uint32_t SecondsToUs(double seconds) {
+    return seconds <= 0.0 ? 0 : (uint32_t)(seconds * 1e6 + 0.5);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s input.txt output.chart\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "r");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    Array tempos = {0};
+    Array beats[CHART_LANES] = {0}; // Note beats per lane, converted once the tempo map is complete
+    double offset = 0.0;
+    char line[MAX_LINE];
+    int lineNumber = 0;
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        char keyword[16], laneName[16];
+        double a, b;
+        if (sscanf(line, "%15s", keyword) != 1) continue;
+
+        if (strcmp(keyword, "offset") == 0 && sscanf(line, "%*s %lf", &a) == 1) {
+            offset = a;
+        } else if (strcmp(keyword, "tempo") == 0 && sscanf(line, "%*s %lf %lf", &a, &b) == 2 && a >= 0 && b > 0) {
+            TextTempo* tempo = ArrayPush(&tempos, sizeof(TextTempo));
+            tempo->beat = a;
+            tempo->bpm = b;
+        } else if (strcmp(keyword, "note") == 0 && sscanf(line, "%*s %lf %15s", &a, laneName) == 2 && a >= 0 && ParseLane(laneName) != -1) {
+            *(double*)ArrayPush(&beats[ParseLane(laneName)], sizeof(double)) = a;
+        } else {
+            fprintf(stderr, "%s:%d: cannot parse: %s", argv[1], lineNumber, line);
+            return 1;
+        }
+    }
+    fclose(in);
+
+    qsort(tempos.items, tempos.count, sizeof(TextTempo), CompareTempo);
+    TextTempo* tempoList = tempos.items;
+    if (tempos.count == 0 || tempoList[0].beat != 0.0) {
+        fprintf(stderr, "%s: needs a tempo at beat 0\n", argv[1]);
+        return 1;
+    }
+
+    ChartTempo* chartTempos = malloc(tempos.count * sizeof(ChartTempo));
+    for (size_t i = 0; i < tempos.count; i++) {
+        chartTempos[i].timeUs = SecondsToUs(BeatToSeconds(tempoList, tempos.count, offset, tempoList[i].beat));
+        chartTempos[i].beat = (float)tempoList[i].beat;
+        chartTempos[i].bpm = (float)tempoList[i].bpm;
+    }
+
+    ChartNote* notes[CHART_LANES];
+    uint32_t noteCount[CHART_LANES];
+    size_t totalNotes = 0;
+    uint32_t lengthUs = 0;
+    for (int lane = 0; lane < CHART_LANES; lane++) {
+        notes[lane] = malloc((beats[lane].count + 1) * sizeof(ChartNote));
+        for (size_t i = 0; i < beats[lane].count; i++) {
+            double beat = ((double*)beats[lane].items)[i];
+            notes[lane][i].timeUs = SecondsToUs(BeatToSeconds(tempoList, tempos.count, offset, beat));
+        }
+        qsort(notes[lane], beats[lane].count, sizeof(ChartNote), CompareNote);
+
+        noteCount[lane] = (uint32_t)beats[lane].count;
+        if (noteCount[lane] > 0 && notes[lane][noteCount[lane] - 1].timeUs > lengthUs) lengthUs = notes[lane][noteCount[lane] - 1].timeUs;
+        totalNotes += noteCount[lane];
+    }
+
+    if (!ChartSave(argv[2], chartTempos, (uint32_t)tempos.count, (const ChartNote* const*)notes, noteCount)) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    for (int lane = 0; lane < CHART_LANES; lane++) {
+        free(notes[lane]);
+        free(beats[lane].items);
+    }
+    free(chartTempos);
+    free(tempos.items);
+
+    printf("%s: %zu notes, %zu tempo change(s), %.1f s\n", argv[2], totalNotes, tempos.count, lengthUs / 1e6);
+    return 0;
+}
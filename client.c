@@ -3,21 +3,45 @@
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
 #include <pthread.h>
 #include <raylib.h>
 #include <math.h>
+#include <time.h>
+#include "sim.h"
+#include "protocol.h"
+#include "channel.h"
+#include "spsc_queue.h"
+#include "replay.h"
+#include "prof.h"
+#include "assets.h"
+#include "songstream.h"
+#include "rollback.h"
 
-#define SCREEN_WIDTH 1280
-#define SCREEN_HEIGHT 720
-#define TARGET_ZONE_Y 600
-#define ARROW_SPEED 300.0f
-#define PERFECT_THRESHOLD 25.0f
-#define GOOD_THRESHOLD 50.0f
-#define MAX_ARROWS 100
-#define BUFFER_SIZE 1024
 #define PORT 8080
-#define PERFECT_DAMAGE 10.0f
+#define NET_QUEUE_CAPACITY 256 // Events the network thread can run ahead of the game loop
+#define REPLAY_FILE "replay_%u_p%d.replay" // Written when a match ends, by seed and player
+#define TRACE_FILE "trace.json"                // F4 writes the profiler's recent history here
+#define PROF_OVERLAY_LINES 8
+#define CONNECT_TIMEOUT 5   // Seconds before giving up on the server
+#define UPLOAD_BUDGET 0.002 // Seconds of each loading frame spent on texture uploads
+#define TEXTURE_COUNT 5     // Arrows by lane, then the background
+#define MUSIC_BUFFER_MS 100 // Audio queued ahead of the device; deeper rides out longer stalls
+#define UDP_POLL_MS 1       // How long the UDP network thread sleeps between checks for queued presses
+#define FRAME_RATE 60
+#define INPUT_POLL_RATE 1000 // Keyboard polls per second while waiting for the next frame
+#define KEY_LOG_SIZE 64
+#define SENT_PRESS_LOG 64    // Own presses remembered for their judgment, to replay them at their own time
+
+// One of our presses as sent, with the match clock at the poll that saw it
+typedef struct {
+    uint32_t tick;
+    uint8_t lane;
+    double time;
+} SentPress;
 
 typedef enum {
     GAME_STATE_CONNECTING,
@@ -26,158 +50,442 @@ typedef enum {
     GAME_STATE_GAMEOVER
 } GameState;
 
+// This client's view of the match. The chart is spawned locally from the
+// START seed and the match runs here under rollback: our presses count at
+// once, the opponent's are predicted, and the server's judgments correct both.
 typedef struct {
-    Vector2 position;
-    int direction;
-    bool active;
-} Arrow;
+    SimState sim;
+    Rollback rollback;
+    int localId;      // 1: left player, 2: right player
+    bool ready;
+    double startTime; // GetTime() when START arrived
+    double clock;     // Seconds into the match: the song's playback position once it plays, else since START
+    Replay replay;    // The server's judgments for both players, saved at game over
+    SentPress sent[SENT_PRESS_LOG]; // Ring of our latest presses, by sentCount
+    long sentCount;
+    const char* error; // Why we never got into a match, shown on the connecting screen
+} Match;
+
+typedef enum {
+    NET_EVENT_MESSAGE,
+    NET_EVENT_DISCONNECTED
+} NetEventType;
 
+// What the network thread hands to the game loop
 typedef struct {
-    int score;
-    float health;
-    char combo[20];
-    Color laneColor;
-    Arrow arrows[MAX_ARROWS];
-    int arrowCount;
-    int perfectPresses;
-    bool isPlayer1;
-    bool ready;
-} Player;
+    NetEventType type;
+    uint64_t queuedNs; // When the network thread pushed it, for latency stats
+    Message msg;
+} NetEvent;
 
+// The network thread connects, then owns the socket's read side and only
+// talks to the game loop through `events`, so neither thread ever waits on the other.
+// Over UDP it owns the whole socket, and the game loop's messages go through `outgoing`.
 typedef struct {
     int socket;
-    Player* localPlayer;
-    Player* remotePlayer;
-    bool* gameStarted;
-    pthread_mutex_t* mutex;
-    GameState* gameState;
+    bool udp;
+    struct sockaddr_in address;
+    ProtoDecoder* decoder;
+    SpscQueue* events;
+    SpscQueue* outgoing;    // UDP only: messages for the server, sent by the network thread
+    atomic_long fullStalls; // Times the queue was full and the network thread had to wait
+    atomic_bool closing;    // Set once the game loop stops draining
 } NetworkData;
 
-void SpawnArrow(Player* player) {
-    if (player->arrowCount >= MAX_ARROWS) return;
-    
-    Arrow* arrow = &player->arrows[player->arrowCount];
-    arrow->direction = GetRandomValue(0, 3);
-    arrow->active = true;
-    
-    float xPos = player->isPlayer1 ? SCREEN_WIDTH * 0.25f : SCREEN_WIDTH * 0.75f;
-    switch (arrow->direction) {
-        case 0: xPos -= 50; break;
-        case 1: xPos += 50; break;
-        case 2: xPos -= 150; break;
-        case 3: xPos += 150; break;
+// Per-frame view of the event queue, shown in the F3 overlay
+typedef struct {
+    int drained;        // Events applied last frame
+    int maxDrained;
+    double latencyMs;   // Worst queue wait among last frame's events
+    double maxLatencyMs;
+    long total;
+} NetQueueStats;
+
+static uint64_t NowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Keys pressed since the last frame, each stamped with the match clock at the poll that saw it
+typedef struct {
+    int keys[KEY_LOG_SIZE];
+    double times[KEY_LOG_SIZE];
+    int count;
+} KeyLog;
+
+// Function to get the current match tick on this client's clock
+static uint32_t MatchTick(const Match* match) {
+    return (uint32_t)(match->clock * SIM_TICK_RATE);
+}
+
+// Function to get when a judged press was made: for our own, the clock at
+// the poll that saw it, otherwise the time of its tick
+static double JudgedPressTime(const Match* match, const MsgJudgment* judgment) {
+    if (judgment->player == match->localId) {
+        for (int i = 0; i < SENT_PRESS_LOG; i++) {
+            const SentPress* sent = &match->sent[i];
+            if (sent->tick == judgment->tick && sent->lane == judgment->lane) return sent->time;
+        }
+    }
+    return judgment->tick * SIM_DT;
+}
+
+// Function to advance the match clock. It follows the song so presses are
+// stamped against what the player hears; before the song plays, and
+// without music, it runs on the wall clock. It never runs backwards.
+static void UpdateMatchClock(Match* match, const SongStream* music, bool musicPlaying) {
+    double clock = musicPlaying ? SongStreamTime(music) : GetTime() - match->startTime;
+    if (clock > match->clock) match->clock = clock;
+}
+
+// Function to take the keys the last poll saw from raylib's queue, which the next poll empties
+static void LogKeys(KeyLog* log, double time) {
+    int key;
+    while ((key = GetKeyPressed()) != 0) {
+        if (log->count == KEY_LOG_SIZE) continue; // Keep draining, an overflow drops presses, not the queue
+        log->keys[log->count] = key;
+        log->times[log->count] = time;
+        log->count++;
+    }
+}
+
+// IsKeyPressed only sees the latest poll, so frame logic asks the log instead
+static bool KeyLogged(const KeyLog* log, int key) {
+    for (int i = 0; i < log->count; i++) {
+        if (log->keys[i] == key) return true;
+    }
+    return false;
+}
+
+// Function to send one whole message on a blocking socket
+bool SendToServer(int socket, const Message* msg) {
+    const char* data = (const char*)msg;
+    size_t remaining = msg->header.length;
+    while (remaining > 0) {
+        ssize_t sent = send(socket, data, remaining, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        remaining -= sent;
+    }
+    return true;
+}
+
+// Function to send a message on whichever transport is in use; over UDP the
+// network thread picks it up within UDP_POLL_MS
+static bool SendOverNetwork(NetworkData* net, const Message* msg) {
+    if (net->udp) return SpscQueuePush(net->outgoing, msg);
+    return SendToServer(net->socket, msg);
+}
+
+// Function to block until the next whole message arrives, false on disconnect or garbage
+bool ReceiveFromServer(int socket, ProtoDecoder* decoder, Message* msg) {
+    while (1) {
+        int result = ProtoDecoderNext(decoder, msg);
+        if (result == 1) return true;
+        if (result < 0) return false;
+
+        size_t space;
+        uint8_t* dst = ProtoDecoderSpace(decoder, &space);
+        ssize_t bytes_received = recv(socket, dst, space, 0);
+        if (bytes_received <= 0) return false;
+        ProtoDecoderCommit(decoder, bytes_received);
+    }
+}
+
+// Function to hand an event to the game loop, waiting out a full queue here
+// rather than ever making the game loop wait
+static void PushNetEvent(NetworkData* data, NetEvent* event) {
+    event->queuedNs = NowNs();
+    while (!SpscQueuePush(data->events, event)) {
+        if (atomic_load(&data->closing)) return;
+        atomic_fetch_add(&data->fullStalls, 1);
+        usleep(1000);
     }
-    arrow->position = (Vector2){ xPos, -50.0f };
-    player->arrowCount++;
 }
 
-void RemoveArrow(Player* player, int index) {
-    if (index < 0 || index >= player->arrowCount) return;
-    for (int i = index; i < player->arrowCount - 1; i++) {
-        player->arrows[i] = player->arrows[i + 1];
+// Only these reach the game loop; pongs and the rest stay on the network thread
+static bool ForGameLoop(uint8_t type) {
+    return type == MSG_ID || type == MSG_FULL || type == MSG_START || type == MSG_SNAPSHOT || type == MSG_JUDGMENT;
+}
+
+// Function to send the channel's next packet, with `unreliable` riding along when given
+static void SendPacket(NetworkData* data, const struct sockaddr_in* server, Channel* channel, const Message* unreliable, uint64_t* lastSent) {
+    uint8_t packet[CHANNEL_PACKET_SIZE];
+    size_t len = ChannelWrite(channel, packet, unreliable, unreliable != NULL ? 1 : 0, NULL, NowNs());
+    sendto(data->socket, packet, len, 0, (const struct sockaddr*)server, sizeof(*server));  // A lost packet is the channel's to recover
+    *lastSent = NowNs();
+}
+
+// UDP transport (see channel.h). Hellos go to the server's lobby until it
+// pairs us; the match is then served from the worker's own port, and the
+// first channel packet from it moves our sends there. Queued presses go out
+// at once, together with every earlier one not yet acked; unacked messages
+// and owed acks go out again every CHANNEL_RESEND_MS. A server silent for
+// CHANNEL_TIMEOUT_MS is gone.
+static void RunUdp(NetworkData* data) {
+    NetEvent event = {0};
+    struct sockaddr_in server = data->address;
+    Channel channel;
+    ChannelInit(&channel, (uint32_t)NowNs() ^ (uint32_t)getpid() << 16);
+    uint8_t packet[CHANNEL_PACKET_SIZE];
+    Message messages[CHANNEL_MAX_MESSAGES];
+    uint64_t lastSent = 0, lastHeard = NowNs();
+    int64_t snapshotTick = -1;
+    uint8_t id = 0;
+
+    while (!atomic_load(&data->closing)) {
+        struct pollfd fd = { .fd = data->socket, .events = POLLIN };
+        poll(&fd, 1, UDP_POLL_MS);
+
+        ssize_t len;
+        struct sockaddr_in from;
+        socklen_t fromLen = sizeof(from);
+        while ((len = recvfrom(data->socket, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr*)&from, &fromLen)) > 0) {
+            fromLen = sizeof(from);
+            bool fromServer = from.sin_addr.s_addr == server.sin_addr.s_addr && from.sin_port == server.sin_port;
+            if (!fromServer && channel.heard) continue;  // Only our match's worker, once it has answered
+            int count = ChannelRead(&channel, packet, (size_t)len, NowNs(), messages, CHANNEL_MAX_MESSAGES);
+            if (count < 0) continue;
+            if (!fromServer) server = from;  // The session matched: this is the worker that took us
+            lastHeard = NowNs();
+
+            for (int i = 0; i < count; i++) {
+                // The lobby repeats our id for every hello, and the worker sends it again
+                if (messages[i].header.type == MSG_ID) {
+                    if (messages[i].id.id == id) continue;
+                    id = messages[i].id.id;
+                }
+                // The server repeats its latest snapshot until it is acked; pass each on once
+                if (messages[i].header.type == MSG_SNAPSHOT) {
+                    if ((int64_t)messages[i].snapshot.tick <= snapshotTick) continue;
+                    snapshotTick = messages[i].snapshot.tick;
+                }
+                if (!ForGameLoop(messages[i].header.type)) continue;
+                event.type = NET_EVENT_MESSAGE;
+                event.msg = messages[i];
+                ProfScope push = ProfBegin("push");
+                PushNetEvent(data, &event);
+                ProfEnd(&push);
+            }
+        }
+        if (NowNs() - lastHeard > CHANNEL_TIMEOUT_MS * 1000000ull) {
+            event.type = NET_EVENT_DISCONNECTED;
+            PushNetEvent(data, &event);
+            return;
+        }
+
+        Message msg;
+        while (SpscQueuePop(data->outgoing, &msg)) {
+            if (!ChannelReliable(msg.header.type)) SendPacket(data, &server, &channel, &msg, &lastSent);
+            else if (!ChannelSend(&channel, &msg)) printf("Server not acking, message dropped\n");
+        }
+
+        uint64_t idle = NowNs() - lastSent;
+        bool owed = ChannelPending(&channel) || channel.ackOwed;
+        if (ChannelUnsent(&channel) || (owed && idle >= CHANNEL_RESEND_MS * 1000000ull) || idle >= CHANNEL_KEEPALIVE_MS * 1000000ull) {
+            SendPacket(data, &server, &channel, NULL, &lastSent);
+        }
     }
-    player->arrowCount--;
 }
 
 void* network_thread(void* arg) {
     NetworkData* data = (NetworkData*)arg;
-    char buffer[BUFFER_SIZE];
+    NetEvent event = {0};
+    ProfThreadName("network");
+    if (data->udp) {
+        RunUdp(data);
+        return NULL;
+    }
+    
+    // Connect here so the window draws and assets load meanwhile; the send
+    // timeout bounds connect, then is lifted for the game loop's sends
+    struct timeval timeout = { .tv_sec = CONNECT_TIMEOUT };
+    setsockopt(data->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(data->socket, (struct sockaddr*)&data->address, sizeof(data->address)) == -1) {
+        event.type = NET_EVENT_DISCONNECTED;
+        PushNetEvent(data, &event);
+        return NULL;
+    }
+    timeout.tv_sec = 0;
+    setsockopt(data->socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int nodelay = 1; // A press goes out at once instead of waiting for the last one's ack
+    setsockopt(data->socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
     
     while (1) {
-        int bytes_received = recv(data->socket, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received <= 0) {
-            *data->gameState = GAME_STATE_GAMEOVER;
+        // Mostly waiting for the server, the trace shows the gaps between messages
+        ProfScope receive = ProfBegin("receive");
+        bool received = ReceiveFromServer(data->socket, data->decoder, &event.msg);
+        ProfEnd(&receive);
+        if (!received) {
+            event.type = NET_EVENT_DISCONNECTED;
+            PushNetEvent(data, &event);
             break;
         }
-        buffer[bytes_received] = '\0';
         
-        pthread_mutex_lock(data->mutex);
+        if (ForGameLoop(event.msg.header.type)) {
+            event.type = NET_EVENT_MESSAGE;
+            ProfScope push = ProfBegin("push");
+            PushNetEvent(data, &event);
+            ProfEnd(&push);
+        }
+    }
+    return NULL;
+}
+
+// Function to apply everything the network thread queued since last frame
+void DrainNetEvents(SpscQueue* events, Match* match, GameState* gameState, NetQueueStats* stats) {
+    uint64_t now = NowNs();
+    NetEvent event;
+    
+    stats->drained = 0;
+    stats->latencyMs = 0.0;
+    while (SpscQueuePop(events, &event)) {
+        double waitedMs = (now - event.queuedNs) / 1e6;
+        if (waitedMs > stats->latencyMs) stats->latencyMs = waitedMs;
+        stats->drained++;
         
-        if (strcmp(buffer, "START") == 0) {
-            *data->gameStarted = true;
-            *data->gameState = GAME_STATE_PLAYING;
+        if (event.type == NET_EVENT_DISCONNECTED) {
+            if (*gameState == GAME_STATE_CONNECTING) {
+                if (match->error == NULL) match->error = "Connection failed";
+                printf("%s\n", match->error);
+            }
+            else *gameState = GAME_STATE_GAMEOVER;
+        }
+        else if (event.msg.header.type == MSG_ID) {
+            match->localId = event.msg.id.id == 2 ? 2 : 1;
+            *gameState = GAME_STATE_WAITING;
+            printf("You are Player %d\n", event.msg.id.id);
+        }
+        else if (event.msg.header.type == MSG_FULL) {
+            match->error = "Server full";
+            printf("Server full\n");
+        }
+        else if (event.msg.header.type == MSG_START) {
+            SimInit(&match->sim, event.msg.start.seed);
+            RollbackReset(&match->rollback, 2 - match->localId); // Predict the opponent
+            ReplayBegin(&match->replay, event.msg.start.seed, NULL);
+            match->startTime = GetTime();
+            match->clock = 0.0;
+            memset(match->sent, 0, sizeof(match->sent));
+            *gameState = GAME_STATE_PLAYING;
             printf("Game starting!\n");
         }
-        else if (strncmp(buffer, "STATE", 5) == 0) {
-            int id;
-            float health;
-            int score;
-            sscanf(buffer, "STATE %d %f %d", &id, &health, &score);
-            data->remotePlayer->health = health;
-            data->remotePlayer->score = score;
+        else if (event.msg.header.type == MSG_JUDGMENT) {
+            // The press is now known for certain; the next frame redoes the match from it
+            const MsgJudgment* judgment = &event.msg.judgment;
+            if (judgment->player < 1 || judgment->player > 2 || judgment->lane >= SIM_LANES) continue;
+            if (judgment->result == PROTO_REJECTED) {
+                // Reached the server too late to count, or it had too many queued
+                if (judgment->player == match->localId) RollbackRejected(&match->rollback, &match->sim, judgment->player - 1, (int)judgment->tick, judgment->lane);
+                continue;
+            }
+            RollbackJudged(&match->rollback, &match->sim, judgment->player - 1, (int)judgment->tick, judgment->lane, (Judgment)judgment->result);
+            ReplayRecord(&match->replay, judgment->tick, JudgedPressTime(match, judgment),
+                         judgment->player - 1, judgment->lane, (Judgment)judgment->result);
+        }
+        else if (event.msg.header.type == MSG_SNAPSHOT) {
+            // Health and score come from the local match; the snapshot only
+            // checks it, and ends the match when the server says so
+            const MsgSnapshot* snapshot = &event.msg.snapshot;
+            float health[2] = { snapshot->players[0].health, snapshot->players[1].health };
+            int score[2] = { snapshot->players[0].score, snapshot->players[1].score };
+            if (*gameState != GAME_STATE_PLAYING) continue;
+            RollbackSnapshot(&match->rollback, &match->sim, (int)snapshot->tick, health, score);
+            if (health[0] <= 0 || health[1] <= 0) {
+                for (int p = 0; p < 2; p++) {
+                    match->sim.players[p].health = health[p];
+                    match->sim.players[p].score = score[p];
+                }
+                *gameState = GAME_STATE_GAMEOVER;
+                ReplayEnd(&match->replay, &match->sim);
+                const char* replayPath = TextFormat(REPLAY_FILE, match->replay.header.seed, match->localId);
+                if (ReplaySave(&match->replay, replayPath)) printf("Replay saved to %s\n", replayPath);
+            }
         }
-        
-        pthread_mutex_unlock(data->mutex);
     }
-    return NULL;
+    
+    stats->total += stats->drained;
+    if (stats->drained > stats->maxDrained) stats->maxDrained = stats->drained;
+    if (stats->latencyMs > stats->maxLatencyMs) stats->maxLatencyMs = stats->latencyMs;
 }
 
-void HandleInput(Player* player, Player* opponent, int socket, GameState* gameState) {
-    if (*gameState == GAME_STATE_WAITING && !player->ready && IsKeyPressed(KEY_SPACE)) {
-        player->ready = true;
-        send(socket, "READY", 5, 0);
-        printf("Player ready, waiting for other player...\n");
-        return;
+// Function to advance loading by one frame: once the loader thread is done,
+// textures go up for at most UPLOAD_BUDGET per frame. True once all are up.
+bool UpdateLoading(AssetLoader* assets, TextureUpload* uploads, bool* uploading) {
+    if (!*uploading) {
+        if (!AssetLoaderDone(assets)) return false;
+        if (assets->failed > 0) printf("%d image(s) failed to load\n", assets->failed);
+        for (int i = 0; i < TEXTURE_COUNT; i++) TextureUploadBegin(&uploads[i], assets->requests[i].image);
+        *uploading = true;
     }
+    
+    double deadline = GetTime() + UPLOAD_BUDGET;
+    for (int i = 0; i < TEXTURE_COUNT; i++) {
+        if (!TextureUploadStep(&uploads[i], deadline)) return false;
+    }
+    AssetLoaderUnloadImages(assets);
+    return true;
+}
 
-    if (*gameState != GAME_STATE_PLAYING) return;
-
-    int pressedDir = -1;
-    if (player->isPlayer1) {
-        if (IsKeyPressed(KEY_W)) pressedDir = 0;
-        if (IsKeyPressed(KEY_S)) pressedDir = 1;
-        if (IsKeyPressed(KEY_A)) pressedDir = 2;
-        if (IsKeyPressed(KEY_D)) pressedDir = 3;
+// Function to get the lane a key presses for this client's player, or -1
+static int LaneForKey(int localId, int key) {
+    if (localId == 1) {
+        if (key == KEY_W) return 0;
+        if (key == KEY_S) return 1;
+        if (key == KEY_A) return 2;
+        if (key == KEY_D) return 3;
     } else {
-        if (IsKeyPressed(KEY_UP)) pressedDir = 0;
-        if (IsKeyPressed(KEY_DOWN)) pressedDir = 1;
-        if (IsKeyPressed(KEY_LEFT)) pressedDir = 2;
-        if (IsKeyPressed(KEY_RIGHT)) pressedDir = 3;
+        if (key == KEY_UP) return 0;
+        if (key == KEY_DOWN) return 1;
+        if (key == KEY_LEFT) return 2;
+        if (key == KEY_RIGHT) return 3;
     }
+    return -1;
+}
 
-    if (pressedDir != -1) {
-        float closestDist = GOOD_THRESHOLD;
-        int closestIdx = -1;
-
-        for (int i = 0; i < player->arrowCount; i++) {
-            if (player->arrows[i].direction == pressedDir) {
-                float dist = fabsf(player->arrows[i].position.y - TARGET_ZONE_Y);
-                if (dist < closestDist) {
-                    closestDist = dist;
-                    closestIdx = i;
-                }
-            }
+// Function to send key presses to the server, which judges them; READY waits for the assets.
+// Each press is stamped with the match clock at the poll that saw it, not this frame's.
+void HandleInput(Match* match, NetworkData* net, GameState* gameState, const KeyLog* keyLog, bool loaded) {
+    if (*gameState == GAME_STATE_WAITING && !match->ready && loaded && KeyLogged(keyLog, KEY_SPACE)) {
+        Message ready;
+        ProtoInit(&ready, MSG_READY);
+        if (!SendOverNetwork(net, &ready)) {
+            printf("Could not send ready, press SPACE again\n");
+            return;
         }
+        match->ready = true;
+        printf("Player ready, waiting for other player...\n");
+        return;
+    }
 
-        if (closestIdx != -1) {
-            float dist = fabsf(player->arrows[closestIdx].position.y - TARGET_ZONE_Y);
-            if (dist < PERFECT_THRESHOLD) {
-                player->score += 100;
-                strcpy(player->combo, "PERFECT!");
-                opponent->health -= PERFECT_DAMAGE;
-                player->perfectPresses++;
-            } else if (dist < GOOD_THRESHOLD) {
-                player->score += 50;
-                strcpy(player->combo, "GOOD!");
-            } else {
-                strcpy(player->combo, "MISS!");
-            }
-            
-            RemoveArrow(player, closestIdx);
-            
-            char buffer[BUFFER_SIZE];
-            snprintf(buffer, BUFFER_SIZE, "UPDATE %.2f %d", player->health, player->score);
-            send(socket, buffer, strlen(buffer), 0);
+    if (*gameState != GAME_STATE_PLAYING) return;
+
+    for (int i = 0; i < keyLog->count; i++) {
+        int lane = LaneForKey(match->localId, keyLog->keys[i]);
+        if (lane == -1) continue;
+        int tick = (int)ceil(keyLog->times[i] * SIM_TICK_RATE);
+        Message input;
+        ProtoInit(&input, MSG_INPUT);
+        input.input.tick = (uint32_t)(tick > 1 ? tick : 1);
+        input.input.lane = (uint8_t)lane;
+        // A press the server will never see must not count here either
+        if (!SendOverNetwork(net, &input)) {
+            printf("Press not sent, dropped\n");
+            continue;
         }
+        RollbackLocalPress(&match->rollback, &match->sim, match->localId - 1, (int)input.input.tick, lane);
+        match->sent[match->sentCount++ % SENT_PRESS_LOG] = (SentPress){ input.input.tick, (uint8_t)lane, keyLog->times[i] };
     }
 }
 
-int main(void) {
+int main(int argc, char** argv) {
+    bool udp = argc > 1 && strcmp(argv[1], "-u") == 0; // UDP transport instead of TCP
     printf("Enter server IP: ");
     char server_ip[16];
     scanf("%s", server_ip);
     
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int sock = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
     if (sock == -1) {
         printf("Socket creation failed\n");
         return 1;
@@ -192,109 +500,135 @@ int main(void) {
         return 1;
     }
 
+    ProfThreadName("main");
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Rhythm Battle");
-    SetTargetFPS(60);
     InitAudioDevice();
 
-    // Load resources
-    Texture2D upArrow = LoadTexture("darrow.png");
-    Texture2D downArrow = LoadTexture("uarrow.png");
-    Texture2D leftArrow = LoadTexture("larrow.png");
-    Texture2D rightArrow = LoadTexture("rarrow.png");
-    Texture2D background = LoadTexture("backd.png");
-    Music gameMusic = LoadMusicStream("bloodymary.mp3");
-    
-    SetMusicVolume(gameMusic, 0.5f);
+    // Load resources in the background while we connect and draw
+    ImageRequest requests[TEXTURE_COUNT] = {
+        { .file = "darrow.png", .scale = 1.0f },
+        { .file = "uarrow.png", .scale = 1.0f },
+        { .file = "larrow.png", .scale = 1.0f },
+        { .file = "rarrow.png", .scale = 1.0f },
+        { .file = "backd.png", .scale = 1.0f }
+    };
+    AssetLoader assets = { .requests = requests, .count = TEXTURE_COUNT, .musicFile = "bloodymary.mp3" };
+    AssetLoaderStart(&assets);
+    TextureUpload uploads[TEXTURE_COUNT] = {0};
+    bool uploading = false, loaded = false;
+    Texture2D upArrow = {0}, downArrow = {0}, leftArrow = {0}, rightArrow = {0}, background = {0};
+    SongStream gameMusic = {0}; // Streams from its own thread once the song is decoded
+    bool hasMusic = false;
     
     GameState gameState = GAME_STATE_CONNECTING;
     
-    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
-        printf("Connection failed\n");
+    Match match = {0};
+    SimInit(&match.sim, 0);
+    match.localId = 1;
+    if (!RollbackInit(&match.rollback)) {
+        printf("Out of memory\n");
         return 1;
     }
     
-    gameState = GAME_STATE_WAITING;
-    
-    Player player1 = {0};
-    Player player2 = {0};
-    player1.health = 100.0f;
-    player2.health = 100.0f;
-    player1.ready = false;
-    player2.ready = false;
-    
-    // Receive player ID from server
-    char buffer[BUFFER_SIZE];
-    int bytes_received = recv(sock, buffer, BUFFER_SIZE - 1, 0);
-    if (bytes_received > 0) {
-        buffer[bytes_received] = '\0';
-        int player_id;
-        if (sscanf(buffer, "ID %d", &player_id) == 1) {
-            player1.isPlayer1 = (player_id == 1);
-            printf("You are Player %d\n", player_id);
-        }
-    }
-    
+    ProtoDecoder decoder;
+    ProtoDecoderReset(&decoder);
     bool gameStarted = false;
-    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    SpscQueue events, outgoing;
+    if (!SpscQueueInit(&events, NET_QUEUE_CAPACITY, sizeof(NetEvent)) || !SpscQueueInit(&outgoing, NET_QUEUE_CAPACITY, sizeof(Message))) {
+        printf("Out of memory\n");
+        return 1;
+    }
     
     NetworkData netData = {
         .socket = sock,
-        .localPlayer = &player1,
-        .remotePlayer = &player2,
-        .gameStarted = &gameStarted,
-        .mutex = &mutex,
-        .gameState = &gameState
+        .udp = udp,
+        .address = server_addr,
+        .decoder = &decoder,
+        .events = &events,
+        .outgoing = &outgoing
     };
+    atomic_init(&netData.fullStalls, 0);
+    atomic_init(&netData.closing, false);
     
     pthread_t net_thread;
     pthread_create(&net_thread, NULL, network_thread, &netData);
     
-    float spawnTimer = 0.0f;
+    NetQueueStats queueStats = {0};
+    bool showDebug = false;
+    char profLines[PROF_OVERLAY_LINES][PROF_LINE_LENGTH];
+    KeyLog keyLog = {0}; // Keys are polled between frames, stamped with the match clock
+    double nextFrameTime = GetTime();
     
     while (!WindowShouldClose()) {
-        UpdateMusicStream(gameMusic);
+        ProfFrame();
+        
+        if (!loaded) {
+            ProfScope load = ProfBegin("load");
+            loaded = UpdateLoading(&assets, uploads, &uploading);
+            ProfEnd(&load);
+            if (loaded) {
+                upArrow = uploads[0].texture;
+                downArrow = uploads[1].texture;
+                leftArrow = uploads[2].texture;
+                rightArrow = uploads[3].texture;
+                background = uploads[4].texture;
+                hasMusic = SongStreamInit(&gameMusic, assets.song, MUSIC_BUFFER_MS);
+                if (!hasMusic) printf("Cannot play the music, timing from the wall clock\n");
+                assets.song = (Wave){0}; // The stream owns the samples now
+                SongStreamSetVolume(&gameMusic, 0.5f);
+            }
+        }
         
-        pthread_mutex_lock(&mutex);
+        if (KeyLogged(&keyLog, KEY_F3)) showDebug = !showDebug;
+        if (KeyLogged(&keyLog, KEY_F4)) {
+            if (ProfWriteTrace(TRACE_FILE)) printf("Profiler trace written to %s\n", TRACE_FILE);
+        }
+        
+        ProfScope phase = ProfBegin("net");
+        GameState previousState = gameState;
+        DrainNetEvents(&events, &match, &gameState, &queueStats);
+        if (gameState == GAME_STATE_PLAYING && previousState != GAME_STATE_PLAYING) {
+            keyLog.count = 0; // Keys from before START carry no match time
+        }
+        ProfEnd(&phase);
         
-        HandleInput(&player1, &player2, sock, &gameState);
+        phase = ProfBegin("input");
+        if (gameState == GAME_STATE_PLAYING) UpdateMatchClock(&match, &gameMusic, gameStarted && hasMusic);
+        HandleInput(&match, &netData, &gameState, &keyLog, loaded);
+        keyLog.count = 0;
+        ProfEnd(&phase);
         
         if (gameState == GAME_STATE_PLAYING) {
+            phase = ProfBegin("sim");
             if (!gameStarted) {
-                PlayMusicStream(gameMusic);
+                SongStreamPlay(&gameMusic);
                 gameStarted = true;
             }
             
-            spawnTimer += GetFrameTime();
-            if (spawnTimer >= 2.0f) {
-                SpawnArrow(&player1);
-                spawnTimer = 0.0f;
-            }
-            
-            // Update arrows
-            for (int i = 0; i < player1.arrowCount; i++) {
-                player1.arrows[i].position.y += ARROW_SPEED * GetFrameTime();
-                if (player1.arrows[i].position.y > SCREEN_HEIGHT) {
-                    RemoveArrow(&player1, i);
-                    i--;
-                }
-            }
+            // Redo the match from whatever the server corrected, then run it up to the match clock
+            RollbackAdvance(&match.rollback, &match.sim, (int)MatchTick(&match));
+            ProfEnd(&phase);
         }
         
+        Player* player1 = &match.sim.players[match.localId - 1]; // This client, known once ID arrives
+        Player* player2 = &match.sim.players[2 - match.localId]; // The opponent
+        
+        phase = ProfBegin("draw");
         BeginDrawing();
         ClearBackground(BLACK);
         
         switch (gameState) {
             case GAME_STATE_CONNECTING:
-                DrawText("Connecting to server...", SCREEN_WIDTH/2 - 100, SCREEN_HEIGHT/2, 20, WHITE);
+                DrawText(match.error != NULL ? match.error : "Connecting to server...", SCREEN_WIDTH/2 - 100, SCREEN_HEIGHT/2, 20, WHITE);
                 break;
                 
             case GAME_STATE_WAITING:
-                if (!player1.ready) {
+                if (!match.ready) {
                     DrawText("Press SPACE when ready!", SCREEN_WIDTH/2 - 120, SCREEN_HEIGHT/2, 20, WHITE);
                 } else {
                     DrawText("Waiting for other player...", SCREEN_WIDTH/2 - 120, SCREEN_HEIGHT/2, 20, WHITE);
                 }
-                DrawText(TextFormat("You are Player %d", player1.isPlayer1 ? 1 : 2), 
+                DrawText(TextFormat("You are Player %d", match.localId), 
                         SCREEN_WIDTH/2 - 80, SCREEN_HEIGHT/2 - 50, 20, WHITE);
                 break;
                 
@@ -302,25 +636,33 @@ int main(void) {
                 DrawTexture(background, 0, 0, WHITE);
                 
                 // Draw UI elements
-                DrawText(TextFormat("Score: %d", player1.score), 20, 20, 20, WHITE);
-                DrawText(TextFormat("Health: %.0f%%", player1.health), 20, 50, 20, WHITE);
-                DrawText(player1.combo, 20, 80, 20, YELLOW);
+                DrawText(TextFormat("Score: %d", player1->score), 20, 20, 20, WHITE);
+                DrawText(TextFormat("Health: %.0f%%", player1->health), 20, 50, 20, WHITE);
+                DrawText(player1->combo, 20, 80, 20, YELLOW);
                 
-                DrawText(TextFormat("Opponent Score: %d", player2.score), SCREEN_WIDTH - 200, 20, 20, WHITE);
-                DrawText(TextFormat("Opponent Health: %.0f%%", player2.health), SCREEN_WIDTH - 200, 50, 20, WHITE);
+                DrawText(TextFormat("Opponent Score: %d", player2->score), SCREEN_WIDTH - 200, 20, 20, WHITE);
+                DrawText(TextFormat("Opponent Health: %.0f%%", player2->health), SCREEN_WIDTH - 200, 50, 20, WHITE);
                 
-                // Draw arrows
-                for (int i = 0; i < player1.arrowCount; i++) {
-                    Arrow* arrow = &player1.arrows[i];
-                    Texture2D* arrowTexture;
-                    switch (arrow->direction) {
-                        case 0: arrowTexture = &upArrow; break;
-                        case 1: arrowTexture = &downArrow; break;
-                        case 2: arrowTexture = &leftArrow; break;
-                        case 3: arrowTexture = &rightArrow; break;
-                        default: continue;
+                // Draw both players' arrows where they are at the exact frame time,
+                // computed here: the sim's state is only ever changed by SimStep
+                float time = (float)match.clock;
+                for (int p = 0; p < 2; p++) {
+                    for (int lane = 0; lane < SIM_LANES; lane++) {
+                        ArrowRing* ring = &match.sim.players[p].lanes[lane];
+                        for (int i = 0; i < ring->count; i++) {
+                            Arrow* arrow = ArrowRingAt(ring, i);
+                            if (!arrow->active) continue;
+                            Texture2D* arrowTexture;
+                            switch (arrow->direction) {
+                                case 0: arrowTexture = &upArrow; break;
+                                case 1: arrowTexture = &downArrow; break;
+                                case 2: arrowTexture = &leftArrow; break;
+                                case 3: arrowTexture = &rightArrow; break;
+                                default: continue;
+                            }
+                            DrawTexture(*arrowTexture, arrow->x, ArrowY(arrow, TARGET_ZONE_Y, time, ARROW_SPEED), WHITE);
+                        }
                     }
-                    DrawTexture(*arrowTexture, arrow->position.x, arrow->position.y, WHITE);
                 }
                 
                 // Draw target zones
@@ -331,10 +673,10 @@ int main(void) {
                 
             case GAME_STATE_GAMEOVER:
                 DrawText("Game Over!", SCREEN_WIDTH/2 - 100, SCREEN_HEIGHT/2, 40, WHITE);
-                DrawText(TextFormat("Final Score: %d", player1.score), SCREEN_WIDTH/2 - 80, SCREEN_HEIGHT/2 + 50, 20, WHITE);
-                if (player1.health <= 0 && player2.health > 0) {
+                DrawText(TextFormat("Final Score: %d", player1->score), SCREEN_WIDTH/2 - 80, SCREEN_HEIGHT/2 + 50, 20, WHITE);
+                if (player1->health <= 0 && player2->health > 0) {
                     DrawText("You Lost!", SCREEN_WIDTH/2 - 60, SCREEN_HEIGHT/2 + 90, 30, RED);
-                } else if (player1.health > 0 && player2.health <= 0) {
+                } else if (player1->health > 0 && player2->health <= 0) {
                     DrawText("You Won!", SCREEN_WIDTH/2 - 60, SCREEN_HEIGHT/2 + 90, 30, GREEN);
                 } else {
                     DrawText("Draw!", SCREEN_WIDTH/2 - 40, SCREEN_HEIGHT/2 + 90, 30, YELLOW);
@@ -342,9 +684,51 @@ int main(void) {
                 break;
         }
         
+        if (!loaded && (gameState == GAME_STATE_CONNECTING || gameState == GAME_STATE_WAITING)) {
+            DrawText(TextFormat("Loading... %d%%", (int)(100 * AssetLoaderProgress(&assets))), SCREEN_WIDTH/2 - 60, SCREEN_HEIGHT/2 + 40, 20, GRAY);
+        }
+        
+        if (showDebug) {
+            int lineCount = ProfOverlayLines(profLines, PROF_OVERLAY_LINES);
+            for (int i = 0; i < lineCount; i++) {
+                DrawText(profLines[i], 10, SCREEN_HEIGHT - 100 - 22 * (lineCount - i), 20, GREEN);
+            }
+            const RollbackStats* rollback = &match.rollback.stats;
+            DrawText(TextFormat("Rollback: %ld rewinds, %d ticks redone last frame (max %d), %.3f ms (max %.3f), %ld late, %ld desyncs, %ld folded",
+                                rollback->rewinds, rollback->lastTicks, rollback->maxTicks, rollback->lastMs, rollback->maxMs, rollback->late, rollback->desyncs, rollback->folded),
+                     10, SCREEN_HEIGHT - 100, 20, GREEN);
+            DrawFPS(10, SCREEN_HEIGHT - 75);
+            DrawText(TextFormat("Audio: %d ms buffered of %d, %lu underruns", SongStreamBufferedMs(&gameMusic), gameMusic.depthMs, SongStreamUnderruns(&gameMusic)),
+                     120, SCREEN_HEIGHT - 75, 20, GREEN);
+            DrawText(TextFormat("Net queue: %d events last frame (max %d), %zu pending, %ld total",
+                                queueStats.drained, queueStats.maxDrained, SpscQueueDepth(&events), queueStats.total),
+                     10, SCREEN_HEIGHT - 50, 20, GREEN);
+            DrawText(TextFormat("Net latency: %.2f ms last frame, %.2f ms max, %ld full-queue stalls",
+                                queueStats.latencyMs, queueStats.maxLatencyMs, atomic_load(&netData.fullStalls)),
+                     10, SCREEN_HEIGHT - 25, 20, GREEN);
+        }
+        ProfEnd(&phase);
+        
+        phase = ProfBegin("present");
         EndDrawing();
+        ProfEnd(&phase);
         
-        pthread_mutex_unlock(&mutex);
+        // Frame pacing: wait for the next frame polling the keyboard, so a
+        // press is stamped within a poll of when it happened rather than at
+        // the next frame. A late frame moves the schedule instead of rushing.
+        phase = ProfBegin("poll");
+        bool inMatch = gameState == GAME_STATE_PLAYING;
+        if (inMatch) UpdateMatchClock(&match, &gameMusic, gameStarted && hasMusic);
+        LogKeys(&keyLog, match.clock);
+        nextFrameTime += 1.0 / FRAME_RATE;
+        if (nextFrameTime < GetTime()) nextFrameTime = GetTime();
+        for (double now = GetTime(); now < nextFrameTime; now = GetTime()) {
+            WaitTime(nextFrameTime - now < 1.0 / INPUT_POLL_RATE ? nextFrameTime - now : 1.0 / INPUT_POLL_RATE);
+            PollInputEvents();
+            if (inMatch) UpdateMatchClock(&match, &gameMusic, gameStarted && hasMusic);
+            LogKeys(&keyLog, match.clock);
+        }
+        ProfEnd(&phase);
     }
     
     // Cleanup
@@ -353,12 +737,25 @@ int main(void) {
     UnloadTexture(leftArrow);
     UnloadTexture(rightArrow);
     UnloadTexture(background);
-    UnloadMusicStream(gameMusic);
+    if (!loaded) {
+        // Quit while loading: drop the partial uploads and wait for the loader
+        for (int i = 0; i < TEXTURE_COUNT; i++) UnloadTexture(uploads[i].texture);
+        AssetLoaderUnloadImages(&assets);
+    }
+    SongStreamUnload(&gameMusic);
+    UnloadWave(assets.song); // Only still there if we quit while loading
     CloseAudioDevice();
     CloseWindow();
     
+    // Unblock the network thread's recv so it exits before the queues go away
+    atomic_store(&netData.closing, true);
+    shutdown(sock, SHUT_RDWR);
+    pthread_join(net_thread, NULL);
     close(sock);
-    pthread_mutex_destroy(&mutex);
+    SpscQueueFree(&events);
+    SpscQueueFree(&outgoing);
+    ReplayFree(&match.replay);
+    RollbackFree(&match.rollback);
     
     return 0;
 }
@@ -1,192 +1,265 @@
 #include "raylib.h"
+#include "sim.h"
+#include "replay.h"
+#include "prof.h"
+#include "atlas.h"
+#include "assets.h"
+#include "songstream.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
-
-// Constants
-#define SCREEN_WIDTH 1280
-#define SCREEN_HEIGHT 720
-#define TARGET_ZONE_Y 600
-#define ARROW_SPEED 300.0f
-#define PERFECT_THRESHOLD 25.0f
-#define GOOD_THRESHOLD 50.0f
-#define MAX_ARROWS 100
-#define INITIAL_SPAWN_INTERVAL 2.0f
-#define DIFFICULTY_INCREASE_INTERVAL 15.0f
-#define SPAWN_INTERVAL_DECREASE 0.5f
-#define MIN_SPAWN_INTERVAL 0.5f
-#define PERFECT_DAMAGE 2.5f
-#define UP_DOWN_HITBOX 200.0f
-#define TIMING_RANGE 50.0f
+#include <time.h>
+
+#define POSE_BASE 0  // Idle pose, lane poses follow at lane + 1
+#define POSE_COUNT 5
+#define ARROW_SCALE 0.33f
+#define CHARACTER_SCALE 0.5f
+#define SPRITE_ARROW 0                // Arrow sprites by lane
+#define SPRITE_POSE SIM_LANES         // Pose sprites by side * POSE_COUNT + pose
+#define SPRITE_COUNT (SIM_LANES + 2 * POSE_COUNT)
+#define MUSIC_FILE "bloodymary.mp3"
+#define MUSIC_BUFFER_MS 100           // Audio queued ahead of the device; deeper rides out longer stalls
+#define BACKGROUND_FILE "backd.png"
+#define CHART_FILE "bloodymary.chart" // Optional; without it arrows are generated
+#define ASSET_PACK "assets.pak"       // Optional; assets it lacks load from the loose files
+#define REPLAY_FILE "replay_%u.replay"  // Written after every finished match, by seed
+#define TRACE_FILE "trace.json"          // F4 writes the profiler's recent history here
+#define PROF_OVERLAY_LINES 8
+#define UPLOAD_BUDGET 0.002 // Seconds of each loading frame spent on texture uploads
+#define FRAME_RATE 60
+#define INPUT_POLL_RATE 1000 // Keyboard polls per second while waiting for the next frame
+#define KEY_LOG_SIZE 64
+#define PRESS_QUEUE_SIZE 64
 
 typedef enum { STATE_START_SCREEN, STATE_GAME, STATE_END_SCREEN } GameStateEnum;
 
-// Arrow structure
-typedef struct {
-    Vector2 position;
-    int direction; // 0: up, 1: down, 2: left, 3: right
-    bool active;
-} Arrow;
-
-// Player structure
-typedef struct {
-    int score;
-    float health;
-    char combo[20];
-    Color laneColor;
-    Arrow arrows[MAX_ARROWS];
-    int arrowCount;
-    int perfectPresses;
-} Player;
-
 // Character structure
 typedef struct {
     Vector2 position;
     float scale;
-    Texture2D texture;
+    int side; // 0: left, 1: right
+    int pose;
     int currentDirection;
 } Character;
 
-// Game state structure
+// Atlas contents in sprite order: arrows by lane (lane 0 is drawn with the
+// "d" image), then pose images per side in POSE_BASE then lane order
+static const char* spriteFiles[SPRITE_COUNT] = {
+    "darrow.png", "uarrow.png", "larrow.png", "rarrow.png",
+    "baseg.png", "downg.png", "upg.png", "leftg.png", "rightg.png",
+    "basez.png", "downz.png", "upz.png", "leftz.png", "rightz.png"
+};
+static const float spriteScales[SPRITE_COUNT] = {
+    ARROW_SCALE, ARROW_SCALE, ARROW_SCALE, ARROW_SCALE,
+    CHARACTER_SCALE, CHARACTER_SCALE, CHARACTER_SCALE, CHARACTER_SCALE, CHARACTER_SCALE,
+    CHARACTER_SCALE, CHARACTER_SCALE, CHARACTER_SCALE, CHARACTER_SCALE, CHARACTER_SCALE
+};
+
+// Texture load counters, so loads sneaking back into the frame loop show up
+static int textureLoadsThisFrame = 0;
+static int textureLoadsTotal = 0;
+
+void BeginUploadCounted(TextureUpload* upload, Image image) {
+    textureLoadsThisFrame++;
+    textureLoadsTotal++;
+    TextureUploadBegin(upload, image);
+}
+
+// Assets the match screen needs, loaded while the start screen is up
 typedef struct {
-    float spawnTimer;
-    float currentSpawnInterval;
-    float difficultyTimer;
-} GameState;
-
-// Function to spawn a new arrow
-void SpawnArrow(Player* player, bool isLeftSide) {
-    if (player->arrowCount >= MAX_ARROWS) return;
-
-    Arrow* arrow = &player->arrows[player->arrowCount];
-    arrow->direction = GetRandomValue(0, 3);
-    arrow->active = true;
-
-    float xPos = isLeftSide ? SCREEN_WIDTH * 0.16f : SCREEN_WIDTH * 0.84f;
-
-    switch (arrow->direction) {
-        case 0: xPos -= 50; break;  // Up arrow
-        case 1: xPos += 50; break;  // Down arrow
-        case 2: xPos -= 150; break; // Left arrow
-        case 3: xPos += 150; break; // Right arrow
-    }
+    AssetLoader assets;
+    ImageRequest requests[SPRITE_COUNT + 1]; // Sprites in atlas order, then the background
+    TextureUpload atlas, background;
+    bool uploading;
+    bool ready;
+    float progress;     // 0 to 1, for the start screen
+    int uploadFrames;   // Frames the uploads were spread over
+} Loading;
+
+// Keys pressed since the last frame, each stamped with the match clock at the poll that saw it
+typedef struct {
+    int keys[KEY_LOG_SIZE];
+    double times[KEY_LOG_SIZE];
+    int count;
+} KeyLog;
 
-    arrow->position = (Vector2){ xPos, -50.0f };
-    player->arrowCount++;
+// A lane press waiting for the step that judges it
+typedef struct {
+    int tick;
+    double time;
+    int player;
+    int lane;
+} TimedPress;
+
+// Function to take the keys the last poll saw from raylib's queue, which the next poll empties
+static void LogKeys(KeyLog* log, double time) {
+    int key;
+    while ((key = GetKeyPressed()) != 0) {
+        if (log->count == KEY_LOG_SIZE) continue; // Keep draining, an overflow drops presses, not the queue
+        log->keys[log->count] = key;
+        log->times[log->count] = time;
+        log->count++;
+    }
 }
 
-// Function to remove an arrow
-void RemoveArrow(Player* player, int index) {
-    if (index < 0 || index >= player->arrowCount) return; // Shift remaining arrows left
-    for (int i = index; i < player->arrowCount - 1; i++) {
-        player->arrows[i] = player->arrows[i + 1];
+// IsKeyPressed only sees the latest poll, so frame logic asks the log instead
+static bool KeyLogged(const KeyLog* log, int key) {
+    for (int i = 0; i < log->count; i++) {
+        if (log->keys[i] == key) return true;
     }
-    player->arrowCount--;
+    return false;
+}
+
+// Function to advance the match clock: the song's playback position, or the
+// wall clock without music. Never backwards, the song clock can wobble.
+static double UpdateMatchClock(double songTime, const SongStream* music, bool hasMusic, double matchStartTime) {
+    double clock = hasMusic ? SongStreamTime(music) : GetTime() - matchStartTime;
+    return clock > songTime ? clock : songTime;
 }
 
 // Function to draw arrows
-void DrawArrow(Vector2 pos, int direction, Color color, Texture2D upArrow, Texture2D downArrow, Texture2D leftArrow, Texture2D rightArrow) {
-    float scale = 0.33f; // Arrow scale set to 0.33f
-
-    switch (direction) {
-        case 0: // Up
-            DrawTextureEx(upArrow, (Vector2){ pos.x - (upArrow.width * scale) / 2, pos.y - (upArrow.height * scale) / 2 }, 0.0f, scale, color);
-            break;
-        case 1: // Down
-            DrawTextureEx(downArrow, (Vector2){ pos.x - (downArrow.width * scale) / 2, pos.y - (downArrow.height * scale) / 2 }, 0.0f, scale, color);
-            break;
-        case 2: // Left
-            DrawTextureEx(leftArrow, (Vector2){ pos.x - (leftArrow.width * scale) / 2, pos.y - (leftArrow.height * scale) / 2 }, 0.0f, scale, color);
-            break;
-        case 3: // Right
-            DrawTextureEx(rightArrow, (Vector2){ pos.x - (rightArrow.width * scale) / 2, pos.y - (rightArrow.height * scale) / 2 }, 0.0f, scale, color);
-            break;
-    }
+void DrawArrow(const Atlas* atlas, Vector2 pos, int direction, Color color) {
+    DrawSprite(atlas, SPRITE_ARROW + direction, pos, ARROW_SCALE, color);
 }
 
-// Function to handle player input
-void HandleInput(Player* attacker, Player * defender, Character* character, bool isLeftPlayer) {
+// Function to handle one pressed key for a player, returns the pressed lane or SIM_NO_PRESS
+int HandleInput(Character* character, bool isLeftPlayer, int key) {
     int pressedDir = -1;
 
     if (isLeftPlayer) {
-        if (IsKeyPressed(KEY_S)) pressedDir = 0; // Up (swapped to 'S' for down)
-        else if (IsKeyPressed(KEY_W)) pressedDir = 1; // Down (swapped to 'W' for up)
-        else if (IsKeyPressed(KEY_A)) pressedDir = 2; // Left
-        else if (IsKeyPressed(KEY_D)) pressedDir = 3; // Right
+        if (key == KEY_S) pressedDir = 0; // Up (swapped to 'S' for down)
+        else if (key == KEY_W) pressedDir = 1; // Down (swapped to 'W' for up)
+        else if (key == KEY_A) pressedDir = 2; // Left
+        else if (key == KEY_D) pressedDir = 3; // Right
     } else {
-        if (IsKeyPressed(KEY_DOWN)) pressedDir = 4; // Up (swapped to down arrow)
-        else if (IsKeyPressed(KEY_UP)) pressedDir = 5; // Down (swapped to up arrow)
-        else if (IsKeyPressed(KEY_LEFT)) pressedDir = 6; // Left
-        else if (IsKeyPressed(KEY_RIGHT)) pressedDir = 7; // Right
+        if (key == KEY_DOWN) pressedDir = 4; // Up (swapped to down arrow)
+        else if (key == KEY_UP) pressedDir = 5; // Down (swapped to up arrow)
+        else if (key == KEY_LEFT) pressedDir = 6; // Left
+        else if (key == KEY_RIGHT) pressedDir = 7; // Right
     }
 
-    if (pressedDir != -1) {
-        // Update character texture based on direction
-        character->currentDirection = pressedDir;
-
-        switch (pressedDir) {
-            case 0: character->texture = LoadTexture("downg.png"); break;
-            case 1: character->texture = LoadTexture("upg.png"); break;
-            case 2: character->texture = LoadTexture("leftg.png"); break;
-            case 3: character->texture = LoadTexture("rightg.png"); break;
-            case 4: character->texture = LoadTexture("downz.png"); break;
-            case 5: character->texture = LoadTexture("upz.png"); break;
-            case 6: character->texture = LoadTexture("leftz.png"); break;
-            case 7: character->texture = LoadTexture("rightz.png"); break;
-        }
+    if (pressedDir == -1) return SIM_NO_PRESS;
 
-        float closestDist = GOOD_THRESHOLD;
-        int closestIdx = -1;
+    // Switch the character to the cached pose for this direction
+    character->currentDirection = pressedDir;
+    character->pose = pressedDir % 4 + 1;
 
-        for (int i = 0; i < attacker->arrowCount; i++) {
-            int arrowDirection = attacker->arrows[i].direction + (isLeftPlayer ? 0 : 4); // Adjust arrow direction for right player
+    return pressedDir % 4; // Lanes use the arrow direction numbering
+}
 
-            // Check if the pressed direction matches the arrow direction
-            if (arrowDirection == pressedDir) {
-                float dist = fabsf(attacker->arrows[i].position.y - TARGET_ZONE_Y);
+// Function to draw characters
+void DrawCharacter(Character character, const Atlas* atlas) {
+    DrawSprite(atlas, SPRITE_POSE + character.side * POSE_COUNT + character.pose, character.position, character.scale, WHITE);
+}
 
-                if (dist < closestDist) {
-                    closestDist = dist;
-                    closestIdx = i;
-                }
-            }
-        }
+// HUD values the cached HUD layer was last drawn with
+typedef struct {
+    int score[2];
+    float health[2];
+    char combo[2][20];
+    bool valid;
+    int redraws;
+} HudCache;
+
+// Function to bake everything on the match screen that never changes: the
+// background at screen scale, the HUD labels and the empty health bars
+void BakeStaticLayer(RenderTexture2D layer, Texture2D background, float scale) {
+    BeginTextureMode(layer);
+    ClearBackground(BLACK);
+    DrawTextureEx(background, (Vector2){0, 0}, 0.0f, scale, WHITE);
 
-        // Apply scoring based on timing
-        if (closestIdx != -1) {
-            float dist = fabsf(attacker->arrows[closestIdx].position.y - TARGET_ZONE_Y);
-
-            if (dist < PERFECT_THRESHOLD) {
-                attacker->score += 100;
-                strcpy(attacker->combo, "PERFECT!");
-                defender->health -= PERFECT_DAMAGE;
-                if (defender->health < 0) defender->health = 0;
-                attacker->perfectPresses++;
-            } else if ((pressedDir % 2 == 1 || pressedDir % 2 == 2) && dist < UP_DOWN_HITBOX) {
-                attacker->score += 50;
-                strcpy(attacker->combo, "GOOD!");
-            } else if ((pressedDir % 2 == 3 || pressedDir % 2 == 4) && dist < TIMING_RANGE) {
-                attacker->score += 50;
-                strcpy(attacker->combo, "GOOD!");
-            } else {
-                strcpy(attacker->combo, "MISS!");
-            }
+    DrawText("Score: ", 50, 50, 20, BLACK);
+    DrawText("Combo: ", 50, 110, 20, BLACK);
+    DrawRectangle(20, 80, 200, 20, RED);
 
-            RemoveArrow(attacker, closestIdx);
-        } else {
-            strcpy(attacker->combo, "MISS!");
-        }
+    DrawText("Score: ", SCREEN_WIDTH - 200, 50, 20, BLACK);
+    DrawText("Combo: ", SCREEN_WIDTH - 200, 110, 20, BLACK);
+    DrawRectangle(SCREEN_WIDTH - 220, 80, 200, 20, RED);
+    EndTextureMode();
+}
+
+// Function to redraw the HUD layer (static layer plus scores, combos and
+// health) when one of those values changed. Call outside BeginDrawing.
+void UpdateHudLayer(RenderTexture2D hud, RenderTexture2D staticLayer, const SimState* sim, HudCache* cache) {
+    bool changed = !cache->valid;
+    for (int p = 0; p < 2 && !changed; p++) {
+        changed = sim->players[p].score != cache->score[p] || sim->players[p].health != cache->health[p] ||
+                  strcmp(sim->players[p].combo, cache->combo[p]) != 0;
     }
+    if (!changed) return;
+
+    for (int p = 0; p < 2; p++) {
+        cache->score[p] = sim->players[p].score;
+        cache->health[p] = sim->players[p].health;
+        strcpy(cache->combo[p], sim->players[p].combo);
+    }
+    cache->valid = true;
+    cache->redraws++;
+
+    // Render textures are stored upside down, hence the negative source height
+    BeginTextureMode(hud);
+    DrawTextureRec(staticLayer.texture, (Rectangle){ 0, 0, SCREEN_WIDTH, -SCREEN_HEIGHT }, (Vector2){ 0, 0 }, WHITE);
+
+    DrawText(TextFormat("%d", cache->score[0]), 150, 50, 20, BLACK);
+    DrawRectangle(20, 80, 200 * (cache->health[0] / 100.0f), 20, GREEN);
+    DrawText(cache->combo[0], 150, 110, 20, BLACK);
+
+    DrawText(TextFormat("%d", cache->score[1]), SCREEN_WIDTH - 100, 50, 20, BLACK);
+    DrawRectangle(SCREEN_WIDTH - 220, 80, 200 * (cache->health[1] / 100.0f), 20, GREEN);
+    DrawText(cache->combo[1], SCREEN_WIDTH - 100, 110, 20, BLACK);
+    EndTextureMode();
 }
 
-// Function to draw characters
-void DrawCharacter(Character character) {
-    DrawTextureEx(character.texture, (Vector2){ character.position.x - (character.texture.width * character.scale) / 2, character.position.y - (character.texture.height * character.scale) / 2 }, 0.0f, character.scale, WHITE);
+// Function to advance loading by one frame. Once the loader thread is done,
+// textures go up for at most UPLOAD_BUDGET per frame; when both are complete
+// the static layer is baked and the CPU copies are released.
+void UpdateLoading(Loading* loading, Atlas* atlas, RenderTexture2D staticLayer) {
+    if (loading->ready) return;
+    if (!loading->uploading) {
+        loading->progress = 0.8f * AssetLoaderProgress(&loading->assets);
+        if (!AssetLoaderDone(&loading->assets)) return;
+        if (loading->assets.failed > 0) TraceLog(LOG_WARNING, "%d image(s) failed to load", loading->assets.failed);
+        if (loading->assets.atlasImage.data == NULL) TraceLog(LOG_WARNING, "Sprite atlas incomplete");
+        BeginUploadCounted(&loading->atlas, loading->assets.atlasImage);
+        BeginUploadCounted(&loading->background, loading->requests[SPRITE_COUNT].image);
+        *atlas = loading->assets.atlas;
+        atlas->texture = loading->atlas.texture;
+        loading->uploading = true;
+    }
+
+    double deadline = GetTime() + UPLOAD_BUDGET;
+    bool done = TextureUploadStep(&loading->atlas, deadline) && TextureUploadStep(&loading->background, deadline);
+    int rows = loading->atlas.rows + loading->background.rows;
+    int totalRows = loading->atlas.image.height + loading->background.image.height;
+    loading->progress = 0.8f + 0.2f * (totalRows > 0 ? (float)rows / totalRows : 1.0f);
+    loading->uploadFrames++;
+    if (!done) return;
+
+    // Scale the background to cover the screen, then keep only the baked copy
+    Texture2D background = loading->background.texture;
+    if (background.width > 0 && background.height > 0) {
+        float scaleX = (float)SCREEN_WIDTH / background.width;
+        float scaleY = (float)SCREEN_HEIGHT / background.height;
+        BakeStaticLayer(staticLayer, background, scaleX > scaleY ? scaleX : scaleY);
+    } else {
+        TraceLog(LOG_WARNING, "Failed to load background texture!");
+        BakeStaticLayer(staticLayer, background, 1.0f);
+    }
+    UnloadTexture(background);
+    loading->background.texture = (Texture2D){0};
+    AssetLoaderUnloadImages(&loading->assets);
+    loading->ready = true;
 }
 
-void DrawStartScreen() {
-    DrawText("Press SPACE to start", SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2, 30, WHITE);
+void DrawStartScreen(const Loading* loading) {
+    if (loading->ready) {
+        DrawText("Press SPACE to start", SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2, 30, WHITE);
+        return;
+    }
+    DrawText("Loading...", SCREEN_WIDTH / 2 - MeasureText("Loading...", 30) / 2, SCREEN_HEIGHT / 2, 30, WHITE);
+    DrawRectangleLines(SCREEN_WIDTH / 2 - 150, SCREEN_HEIGHT / 2 + 45, 300, 16, WHITE);
+    DrawRectangle(SCREEN_WIDTH / 2 - 148, SCREEN_HEIGHT / 2 + 47, (int)(296 * loading->progress), 12, WHITE);
 }
 
 void DrawEndScreen(int leftPlayerHealth, int rightPlayerHealth) {
@@ -206,211 +279,304 @@ void DrawEndScreen(int leftPlayerHealth, int rightPlayerHealth) {
 }
 
 int main(void) {
+    uint64_t launchNs = ProfNow();
+    ProfThreadName("main");
+
     // Initialize window
+    ProfScope phase = ProfBegin("startup: window");
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Rhythm Game");
-    SetTargetFPS(60);
+    // No SetTargetFPS: the loop paces itself, polling input while it waits
 
     // Initialize audio device
     InitAudioDevice();
-
-    // Load textures for arrows and background
-    Texture2D upArrow = LoadTexture("darrow.png");
-    Texture2D downArrow = LoadTexture("uarrow.png");
-    Texture2D leftArrow = LoadTexture("larrow.png");
-    Texture2D rightArrow = LoadTexture("rarrow.png");
-    Texture2D background = LoadTexture("backd.png");  // Load background image
-
-    Texture2D leftCharacterUp = LoadTexture("upg.png");
-    Texture2D leftCharacterDown = LoadTexture ("downg.png");
-    Texture2D leftCharacterLeft = LoadTexture("leftg.png");
-    Texture2D leftCharacterRight = LoadTexture("rightg.png");
-
-    Texture2D rightCharacterUp = LoadTexture("upz.png");
-    Texture2D rightCharacterDown = LoadTexture("downz.png");
-    Texture2D rightCharacterLeft = LoadTexture("leftz.png");
-    Texture2D rightCharacterRight = LoadTexture("rightz.png");
-
-    // Load character textures
-    Texture2D leftCharacterTexture = LoadTexture("baseg.png");  // Load left character texture
-    Texture2D rightCharacterTexture = LoadTexture("basez.png"); // Load right character texture
-
-    // Load music
-    Music music = LoadMusicStream("bloodymary.mp3"); // Load your music file
-    SetMusicVolume(music, 0.5f); // Set volume (0.0f to 1.0f)
-
-    // Check if background texture loaded successfully
-    if (background.width == 0 || background.height == 0) {
-        printf("Failed to load background texture!\n");
-        CloseWindow();
-        return -1;  // Exit if the background fails to load
-    }
-
-    // Calculate scaling factors to fit background to screen
-    float scaleX = (float)SCREEN_WIDTH / background.width;
-    float scaleY = (float)SCREEN_HEIGHT / background.height;
-    float scale = scaleX > scaleY ? scaleX : scaleY;  // Choose the larger scale to cover the screen
-
-    // Initialize players
-    Player leftPlayer = {.score = 0, .health = 100.0f, .combo = "READY!", .laneColor = WHITE, .arrowCount = 0, .perfectPresses = 0};
-    Player rightPlayer = {. score = 0, .health = 100.0f, .combo = "READY!", .laneColor = WHITE, .arrowCount = 0, .perfectPresses = 0};
+    ProfEnd(&phase);
+
+    // Assets load on a background thread behind the start screen: images
+    // come from the asset pack when there is one, else from the loose files
+    Pack pack;
+    bool hasPack = PackOpen(&pack, ASSET_PACK);
+    Loading loading = {0};
+    for (int i = 0; i < SPRITE_COUNT; i++) loading.requests[i] = (ImageRequest){ .file = spriteFiles[i], .scale = spriteScales[i] };
+    loading.requests[SPRITE_COUNT] = (ImageRequest){ .file = BACKGROUND_FILE, .scale = 0.0f }; // Any size, it is scaled to the screen once
+    loading.assets = (AssetLoader){
+        .pack = hasPack ? &pack : NULL,
+        .requests = loading.requests,
+        .count = SPRITE_COUNT + 1,
+        .atlasCount = SPRITE_COUNT, // Arrows and every character pose share one atlas, input only switches sprites
+        .musicFile = MUSIC_FILE
+    };
+    AssetLoaderStart(&loading.assets);
+    Atlas atlas = {0};
+    SongStream music = {0}; // Streams from its own thread once the song is decoded
+    bool hasMusic = false;
+
+    // Map the song's chart if there is one
+    Chart chart;
+    const PackEntry* chartEntry = PackFind(hasPack ? &pack : NULL, CHART_FILE);
+    bool hasChart = chartEntry != NULL
+        ? ChartFromMemory(&chart, PackEntryData(&pack, chartEntry), chartEntry->size)
+        : ChartOpen(&chart, CHART_FILE);
+    if (!hasChart) TraceLog(LOG_INFO, "No %s, generating arrows", CHART_FILE);
+
+    // Render through a batch whose draw calls the F3 overlay can count
+    DrawCallCounterInit();
+
+    // The match screen's background and HUD are drawn into render textures
+    // and only redrawn when they change; each frame blits the HUD layer once
+    RenderTexture2D staticLayer = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+    RenderTexture2D hudLayer = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
+    HudCache hudCache = {0};
+
+    // Initialize the match simulation
+    SimState sim;
+    uint32_t matchSeed = (uint32_t)time(NULL);
+    SimInit(&sim, matchSeed);
+    if (hasChart) SimUseChart(&sim, &chart);
+    Player* leftPlayer = &sim.players[0];
+    Player* rightPlayer = &sim.players[1];
+    Color laneColor = WHITE;
+
+    // Keys are polled between frames and lane presses wait here for the
+    // step at the song time they were made, not the frame that noticed them
+    KeyLog keyLog = {0};
+    TimedPress presses[PRESS_QUEUE_SIZE];
+    int pressCount = 0;
+    double songTime = 0.0; // Match clock in seconds, from the song's playback position
+    double nextFrameTime = GetTime();
+
+    // Every judged press of the current match, saved when it ends
+    Replay replay = {0};
+    double matchStartTime = 0.0; // Only clocks the match when there is no music
 
     // Initialize characters
     Character leftCharacter = { 
         .position = (Vector2){ SCREEN_WIDTH * 0.25f, TARGET_ZONE_Y - 100 },  // Position above the perfection line
-        .scale = 0.5f,  // Set scale for left character
-        .texture = leftCharacterTexture
+        .scale = CHARACTER_SCALE,  // Set scale for left character
+        .side = 0,
+        .pose = POSE_BASE
     };
 
     Character rightCharacter = { 
         .position = (Vector2){ SCREEN_WIDTH * 0.75f, TARGET_ZONE_Y - 100 },  // Position above the perfection line
-        .scale = 0.5f,  // Set scale for right character
-        .texture = rightCharacterTexture
+        .scale = CHARACTER_SCALE,  // Set scale for right character
+        .side = 1,
+        .pose = POSE_BASE
     };
 
-    // Initialize game state
-    GameState gameState = {.spawnTimer = 0.0f, .currentSpawnInterval = INITIAL_SPAWN_INTERVAL, .difficultyTimer = 0.0f};
-
     GameStateEnum currentGameState = STATE_START_SCREEN; // Start in the start screen state
+    bool showDebug = false;
+    int lastFrameDrawCalls = 0;
+    char profLines[PROF_OVERLAY_LINES][PROF_LINE_LENGTH];
+    double firstFrameMs = 0.0, readyMs = 0.0;
 
     // Main game loop
     while (!WindowShouldClose()) {
-        // Update game state
-        gameState.spawnTimer += GetFrameTime();
-        gameState.difficultyTimer += GetFrameTime();
+        ProfFrame();
+
+        // Any texture load after startup is a regression on the frame path
+        if (textureLoadsThisFrame > 0 && currentGameState == STATE_GAME) {
+            TraceLog(LOG_WARNING, "%d texture load(s) during a match frame", textureLoadsThisFrame);
+        }
+        int lastFrameTextureLoads = textureLoadsThisFrame;
+        textureLoadsThisFrame = 0;
+
+        if (KeyLogged(&keyLog, KEY_F3)) showDebug = !showDebug;
+        if (KeyLogged(&keyLog, KEY_F4)) {
+            if (ProfWriteTrace(TRACE_FILE)) TraceLog(LOG_INFO, "Profiler trace written to %s", TRACE_FILE);
+            else TraceLog(LOG_WARNING, "Cannot write %s", TRACE_FILE);
+        }
+
+        // Upload whatever the loader thread has finished, within this frame's budget
+        if (!loading.ready) {
+            ProfScope load = ProfBegin("load");
+            UpdateLoading(&loading, &atlas, staticLayer);
+            ProfEnd(&load);
+            if (loading.ready) {
+                hasMusic = SongStreamInit(&music, loading.assets.song, MUSIC_BUFFER_MS);
+                if (!hasMusic) TraceLog(LOG_WARNING, "Cannot play %s, timing from the wall clock", MUSIC_FILE);
+                loading.assets.song = (Wave){0}; // The stream owns the samples now
+                SongStreamSetVolume(&music, 0.5f); // Set volume (0.0f to 1.0f)
+                int packedImages = 0;
+                for (int i = 0; i <= SPRITE_COUNT; i++) packedImages += loading.requests[i].fromPack;
+                readyMs = (ProfNow() - launchNs) / 1e6;
+                TraceLog(LOG_INFO, "Assets ready %.0f ms after launch, %d of %d images from %s, %d loader thread(s), uploads spread over %d frame(s)",
+                         readyMs, packedImages, SPRITE_COUNT + 1, hasPack ? ASSET_PACK : "no pack",
+                         loading.assets.images.threadCount, loading.uploadFrames);
+            }
+        }
 
         // Check input
-        if (IsKeyPressed(KEY_SPACE) && currentGameState == STATE_START_SCREEN) {
+        if (KeyLogged(&keyLog, KEY_SPACE) && currentGameState == STATE_START_SCREEN && loading.ready) {
             currentGameState = STATE_GAME;
-            PlayMusicStream(music); // Start playing music when game starts
-            SetMusicVolume(music, 1.0f); // Volume range is 0.0 to 1.0
+            ReplayBegin(&replay, matchSeed, hasChart ? &chart : NULL);
+            matchStartTime = GetTime();
+            songTime = 0.0;
+            keyLog.count = 0; // Keys from before the match carry no song time
+            SongStreamPlay(&music); // Start the song from the top when the game starts
+            SongStreamSetVolume(&music, 1.0f); // Volume range is 0.0 to 1.0
         }
 
         if (currentGameState == STATE_GAME) {
-            HandleInput(&leftPlayer, &rightPlayer, &leftCharacter, true);
-            HandleInput(&rightPlayer, &leftPlayer, &rightCharacter, false);
-
-            // Spawn arrows based on the current spawn interval
-            if (gameState.spawnTimer >= gameState.currentSpawnInterval) {
-                SpawnArrow(&leftPlayer, true);   // Spawn arrow for left player
-                SpawnArrow(&rightPlayer, false); // Spawn arrow for right player
-                gameState.spawnTimer = 0.0f;
-            }
-
-            // Every 15 seconds, reduce the spawn interval by 0.5 seconds, if above the minimum
-            if (gameState.difficultyTimer >= DIFFICULTY_INCREASE_INTERVAL) {
-                if (gameState.currentSpawnInterval > MIN_SPAWN_INTERVAL) {
-                    gameState.currentSpawnInterval -= SPAWN_INTERVAL_DECREASE;
-                    if (gameState.currentSpawnInterval < MIN_SPAWN_INTERVAL) {
-                        gameState.currentSpawnInterval = MIN_SPAWN_INTERVAL;
-                    }
+            ProfScope phase = ProfBegin("input");
+            for (int i = 0; i < keyLog.count; i++) {
+                for (int p = 0; p < 2; p++) {
+                    int lane = HandleInput(p == 0 ? &leftCharacter : &rightCharacter, p == 0, keyLog.keys[i]);
+                    if (lane == SIM_NO_PRESS || pressCount == PRESS_QUEUE_SIZE) continue;
+                    int tick = (int)ceil(keyLog.times[i] * SIM_TICK_RATE);
+                    presses[pressCount++] = (TimedPress){ tick > sim.tick + 1 ? tick : sim.tick + 1, keyLog.times[i], p, lane };
                 }
-                gameState.difficultyTimer = 0.0f; // Reset the difficulty timer
             }
-
-            // Update arrows
-            for (int i = 0; i < leftPlayer.arrowCount; i++) {
-                leftPlayer.arrows[i].position.y += ARROW_SPEED * GetFrameTime();
-                if (leftPlayer.arrows[i].position.y > SCREEN_HEIGHT) {
-                    RemoveArrow(&leftPlayer, i);
-                    i--;
+            ProfEnd(&phase);
+
+            // Step the simulation up to the song clock, however many steps a slow
+            // frame left behind; each press goes into the step at its own time,
+            // one per player per step, in the order they were made
+            phase = ProfBegin("sim");
+            songTime = UpdateMatchClock(songTime, &music, hasMusic, matchStartTime);
+            int targetTick = (int)(songTime * SIM_TICK_RATE);
+            while (sim.tick < targetTick && !sim.over) {
+                SimInput input = { .pressedDir = { SIM_NO_PRESS, SIM_NO_PRESS } };
+                double pressTime[2] = { 0.0, 0.0 };
+                int kept = 0;
+                for (int i = 0; i < pressCount; i++) {
+                    TimedPress press = presses[i];
+                    if (press.tick <= sim.tick + 1 && input.pressedDir[press.player] == SIM_NO_PRESS) {
+                        input.pressedDir[press.player] = press.lane;
+                        pressTime[press.player] = press.time;
+                    } else {
+                        presses[kept++] = press;
+                    }
                 }
-            }
+                pressCount = kept;
 
-            for (int i = 0; i < rightPlayer.arrowCount; i++) {
-                rightPlayer.arrows[i].position.y += ARROW_SPEED * GetFrameTime();
-                if (rightPlayer.arrows[i].position.y > SCREEN_HEIGHT) {
-                    RemoveArrow(&rightPlayer, i);
-                    i--;
+                SimStep(&sim, &input);
+                for (int p = 0; p < 2; p++) {
+                    if (input.pressedDir[p] == SIM_NO_PRESS) continue;
+                    ReplayRecord(&replay, (uint32_t)sim.tick, pressTime[p], p, input.pressedDir[p], sim.judged[p]);
                 }
             }
-
-            // Update music stream
-            UpdateMusicStream(music);
+            ProfEnd(&phase);
 
             // Check for game over condition
-            if (leftPlayer.health <= 0 || rightPlayer.health <= 0) {
+            if (sim.over) {
                 currentGameState = STATE_END_SCREEN;
+                SongStreamStop(&music);
+                ReplayEnd(&replay, &sim);
+                const char* replayPath = TextFormat(REPLAY_FILE, matchSeed);
+                if (ReplaySave(&replay, replayPath)) TraceLog(LOG_INFO, "Replay saved to %s", replayPath);
+                else TraceLog(LOG_WARNING, "Cannot write %s", replayPath);
             }
         }
 
         if (currentGameState == STATE_END_SCREEN) {
-            if (IsKeyPressed(KEY_SPACE)) {
-                // Reset player health and game state
-                leftPlayer.health = 100.0f;
-                rightPlayer.health = 100.0f;
+            if (KeyLogged(&keyLog, KEY_SPACE)) {
+                // Start a fresh match
+                matchSeed = (uint32_t)time(NULL);
+                SimInit(&sim, matchSeed);
+                if (hasChart) SimUseChart(&sim, &chart);
+                pressCount = 0;
+                hudCache.valid = false;
                 currentGameState = STATE_START_SCREEN;
             }
         }
 
+        keyLog.count = 0;
+
         // Draw
+        ProfScope draw = ProfBegin("draw");
+        if (currentGameState == STATE_GAME) UpdateHudLayer(hudLayer, staticLayer, &sim, &hudCache);
         BeginDrawing();
         ClearBackground(BLACK);
 
         if (currentGameState == STATE_START_SCREEN) {
-            DrawStartScreen();
+            DrawStartScreen(&loading);
         } else if (currentGameState == STATE_END_SCREEN) {
-            DrawEndScreen(leftPlayer.health, rightPlayer.health);
+            DrawEndScreen(leftPlayer->health, rightPlayer->health);
         } else {
-            // Draw the background image scaled to the screen
-            DrawTextureEx(background, (Vector2){0, 0}, 0.0f, scale, WHITE);
-
-            // Draw left and right characters
-            DrawCharacter(leftCharacter);
-            DrawCharacter(rightCharacter);
-
-            // Draw score, health, and combo for each player
-            DrawText("Score: ", 50, 50, 20, BLACK);
-            DrawText(TextFormat("%d", leftPlayer.score), 150, 50, 20, BLACK);
-
-            DrawRectangle(20, 80,  200, 20, RED);
-            DrawRectangle(20, 80, 200 * (rightPlayer.health / 100.0f), 20, GREEN);
-
-            DrawRectangle(SCREEN_WIDTH - 220, 80, 200, 20, RED);
-            DrawRectangle(SCREEN_WIDTH - 220, 80, 200 * (leftPlayer.health / 100.0f), 20, GREEN);
-
-            DrawText("Combo: ", 50, 110, 20, BLACK);
-            DrawText(leftPlayer.combo, 150, 110, 20, BLACK);
-
-            DrawText("Score: ", SCREEN_WIDTH - 200, 50, 20, BLACK);
-            DrawText(TextFormat("%d", rightPlayer.score), SCREEN_WIDTH - 100, 50, 20, BLACK);
-
-            DrawRectangle(20, 80, 200, 20, RED);
-            DrawRectangle(20, 80, 200 * (leftPlayer.health / 100.0f ), 20, GREEN);
-
-            DrawRectangle(SCREEN_WIDTH - 220, 80, 200, 20, RED);
-            DrawRectangle(SCREEN_WIDTH - 220, 80, 200 * (rightPlayer.health / 100.0f), 20, GREEN);
-
-            DrawText("Combo: ", SCREEN_WIDTH - 200, 110, 20, BLACK);
-            DrawText(rightPlayer.combo, SCREEN_WIDTH - 100, 110, 20, BLACK);
-
-            // Draw arrows for each player
-            for (int i = 0; i < leftPlayer.arrowCount; i++) {
-                DrawArrow(leftPlayer.arrows[i].position, leftPlayer.arrows[i].direction, leftPlayer.laneColor, upArrow, downArrow, leftArrow, rightArrow);
-            }
+            // Background and HUD in one blit, from the cached layer
+            DrawTextureRec(hudLayer.texture, (Rectangle){ 0, 0, SCREEN_WIDTH, -SCREEN_HEIGHT }, (Vector2){ 0, 0 }, WHITE);
+
+            // Characters then arrows, all from the atlas so they go out as one draw call
+            DrawCharacter(leftCharacter, &atlas);
+            DrawCharacter(rightCharacter, &atlas);
+
+            // Draw arrows for each player where they are at this exact song time, not at the last step's
+            float time = (float)songTime;
+            for (int lane = 0; lane < SIM_LANES; lane++) {
+                for (int i = 0; i < leftPlayer->lanes[lane].count; i++) {
+                    Arrow* arrow = ArrowRingAt(&leftPlayer->lanes[lane], i);
+                    if (!arrow->active) continue;
+                    DrawArrow(&atlas, (Vector2){ arrow->x, ArrowY(arrow, TARGET_ZONE_Y, time, ARROW_SPEED) }, arrow->direction, laneColor);
+                }
 
-            for (int i = 0; i < rightPlayer.arrowCount; i++) {
-                DrawArrow(rightPlayer.arrows[i].position, rightPlayer.arrows[i].direction, rightPlayer.laneColor, upArrow, downArrow, leftArrow, rightArrow);
+                for (int i = 0; i < rightPlayer->lanes[lane].count; i++) {
+                    Arrow* arrow = ArrowRingAt(&rightPlayer->lanes[lane], i);
+                    if (!arrow->active) continue;
+                    DrawArrow(&atlas, (Vector2){ arrow->x, ArrowY(arrow, TARGET_ZONE_Y, time, ARROW_SPEED) }, arrow->direction, laneColor);
+                }
             }
 
             // Draw target zone line
             DrawLine(0, TARGET_ZONE_Y, SCREEN_WIDTH, TARGET_ZONE_Y, RED);
         }
 
+        if (showDebug) {
+            int lineCount = ProfOverlayLines(profLines, PROF_OVERLAY_LINES);
+            for (int i = 0; i < lineCount; i++) {
+                DrawText(profLines[i], 10, SCREEN_HEIGHT - 75 - 22 * (lineCount - i), 20, GREEN);
+            }
+            DrawFPS(10, SCREEN_HEIGHT - 75);
+            DrawText(TextFormat("Startup: first frame %.0f ms, assets ready %.0f ms", firstFrameMs, readyMs), 120, SCREEN_HEIGHT - 75, 20, GREEN);
+            DrawText(TextFormat("Audio: %d ms buffered of %d, %lu underruns", SongStreamBufferedMs(&music), music.depthMs, SongStreamUnderruns(&music)),
+                     10, SCREEN_HEIGHT - 50, 20, GREEN);
+            DrawText(TextFormat("Texture loads: %d last frame, %d total   Draw calls: %d last frame   HUD redraws: %d",
+                                lastFrameTextureLoads, textureLoadsTotal, lastFrameDrawCalls, hudCache.redraws), 10, SCREEN_HEIGHT - 25, 20, GREEN);
+        }
+        lastFrameDrawCalls = DrawCallCount();
+        ProfEnd(&draw);
+
+        // Buffer swap and event polling
+        ProfScope present = ProfBegin("present");
         EndDrawing();
+        ProfEnd(&present);
+
+        // Frame pacing: wait for the next frame polling the keyboard, so a
+        // press is stamped within a poll of when it happened rather than at
+        // the next frame. A late frame moves the schedule instead of rushing.
+        ProfScope poll = ProfBegin("poll");
+        bool inMatch = currentGameState == STATE_GAME;
+        if (inMatch) songTime = UpdateMatchClock(songTime, &music, hasMusic, matchStartTime);
+        LogKeys(&keyLog, songTime);
+        nextFrameTime += 1.0 / FRAME_RATE;
+        if (nextFrameTime < GetTime()) nextFrameTime = GetTime();
+        for (double now = GetTime(); now < nextFrameTime; now = GetTime()) {
+            WaitTime(nextFrameTime - now < 1.0 / INPUT_POLL_RATE ? nextFrameTime - now : 1.0 / INPUT_POLL_RATE);
+            PollInputEvents();
+            if (inMatch) songTime = UpdateMatchClock(songTime, &music, hasMusic, matchStartTime);
+            LogKeys(&keyLog, songTime);
+        }
+        ProfEnd(&poll);
+
+        if (firstFrameMs == 0.0) {
+            firstFrameMs = (ProfNow() - launchNs) / 1e6;
+            TraceLog(LOG_INFO, "First frame %.0f ms after launch", firstFrameMs);
+        }
     }
 
     // Unload resources
-    UnloadTexture(upArrow);
-    UnloadTexture(downArrow);
-    UnloadTexture(leftArrow);
-    UnloadTexture(rightArrow);
-    UnloadTexture(background);
-    UnloadTexture(leftCharacterTexture);
-    UnloadTexture(rightCharacterTexture);
-    StopMusicStream(music); // Stop music before unloading
-    UnloadMusicStream(music); // Unload music from memory
+    UnloadRenderTexture(staticLayer);
+    UnloadRenderTexture(hudLayer);
+    UnloadAtlas(&atlas);
+    UnloadTexture(loading.background.texture); // Only still there if we quit mid-upload
+    SongStreamUnload(&music); // Stops the feeder thread and the stream
+    AssetLoaderUnloadImages(&loading.assets); // Waits for the loader if it is still running
+    UnloadWave(loading.assets.song); // Only still there if we quit while loading
+    if (hasChart) ChartClose(&chart);
+    if (hasPack) PackClose(&pack); // Music and chart may point into it
+    ReplayFree(&replay);
 
     CloseAudioDevice(); // Close the audio device
+    DrawCallCounterClose();
     CloseWindow();
 
     return 0;
@@ -0,0 +1,243 @@
+#include "sim.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// Headless match driver: plays bot-vs-bot matches through SimStep with no window.
+// Bots press at a continuous time; the game only sees a press at its next
+// input poll and judges it at the next step, so the timing report shows what
+// polling and tick rate add on top of the bots' own error. Only the steps a
+// bot could press in are taken one by one; SimAdvance runs the rest.
+
+#define DEFAULT_MATCHES 1000
+#define MAX_MATCH_TIME 600.0f // Safety cap so a stalemate cannot hang the run
+#define BOT_AIM_ERROR 40.0f   // Bots press within +/- this many pixels of the target line
+#define ERROR_BUCKET_MS 10    // Timing-error histogram: 10 ms buckets over +/- ERROR_RANGE_MS
+#define ERROR_RANGE_MS 150
+#define LATENCY_BUCKET_MS 0.1 // Latency histogram resolution, for percentiles
+#define LATENCY_BUCKETS 1000  // Up to 100 ms; anything later lands in the last bucket
+
+typedef struct {
+    float aimError; // Seconds after the hit time at which the next press happens
+} Bot;
+
+// Where a press came from, to score it once the step has judged it
+typedef struct {
+    double pressTime; // When the bot pressed
+    float hitTime;    // When the arrow it aimed at crossed the line
+} BotPressInfo;
+
+typedef struct {
+    long errorBuckets[2 * ERROR_RANGE_MS / ERROR_BUCKET_MS + 2]; // Plus one bucket each side for outliers
+    long latencyBuckets[LATENCY_BUCKETS];
+    long judgments[3];
+    long presses;
+    double latencySum;
+} TimingStats;
+
+static float RandomRange(float min, float max) {
+    return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+// Function to pick this step's press for a bot, or SIM_NO_PRESS. A bot presses
+// at hitTime + aimError, and the game sees it at the first poll after that.
+static int BotPress(Bot* bot, Player* player, float time, double pollInterval, BotPressInfo* info) {
+    for (int lane = 0; lane < SIM_LANES; lane++) {
+        int idx = FindJudgeTarget(&player->lanes[lane], time);
+        if (idx == -1) continue;
+
+        const Arrow* arrow = ArrowRingAt(&player->lanes[lane], idx);
+        double pressTime = arrow->hitTime + bot->aimError;
+        double seenTime = ceil(pressTime / pollInterval - 1e-9) * pollInterval;
+        if (seenTime <= time + 1e-6) {
+            *info = (BotPressInfo){ pressTime, arrow->hitTime };
+            bot->aimError = RandomRange(-BOT_AIM_ERROR, BOT_AIM_ERROR) / ARROW_SPEED;
+            return lane;
+        }
+    }
+    return SIM_NO_PRESS;
+}
+
+// Function to get a tick no later than the first step, from `tick` on, at
+// which the bot can press. A lane's next arrow is pressed no sooner than both
+// the poll that sees the press and the opening of its timing window, so the
+// steps before the earliest lane's need no BotPress.
+static int BotEarliestTick(const Bot* bot, Player* player, int tick, double pollInterval) {
+    float time = tick * SIM_DT;
+    int earliest = INT_MAX;
+    for (int lane = 0; lane < SIM_LANES; lane++) {
+        ArrowRing* ring = &player->lanes[lane];
+        for (int i = 0; i < ring->count; i++) {
+            const Arrow* arrow = ArrowRingAt(ring, i);
+            if (!arrow->active || (time - arrow->hitTime) * ARROW_SPEED >= GOOD_THRESHOLD) continue; // Past its window for good
+
+            double pressTime = arrow->hitTime + bot->aimError;
+            double seenTime = ceil(pressTime / pollInterval - 1e-9) * pollInterval;
+            double openTime = arrow->hitTime - GOOD_THRESHOLD / ARROW_SPEED;
+            int laneTick = (int)((seenTime > openTime ? seenTime : openTime) * SIM_TICK_RATE) - 2; // A little early, for float rounding
+            if (laneTick < earliest) earliest = laneTick;
+            break;
+        }
+    }
+    return earliest > tick ? earliest : tick;
+}
+
+// Function to score a judged press: timing error as the game saw it, and the
+// latency from the key going down to the step that judged it
+static void RecordPress(TimingStats* stats, const BotPressInfo* info, float judgedTime, Judgment judgment) {
+    double errorMs = (judgedTime - info->hitTime) * 1000.0;
+    int bucket = (int)floor((errorMs + ERROR_RANGE_MS) / ERROR_BUCKET_MS) + 1;
+    if (bucket < 0) bucket = 0;
+    if (bucket > 2 * ERROR_RANGE_MS / ERROR_BUCKET_MS + 1) bucket = 2 * ERROR_RANGE_MS / ERROR_BUCKET_MS + 1;
+    stats->errorBuckets[bucket]++;
+
+    double latencyMs = (judgedTime - info->pressTime) * 1000.0;
+    int latencyBucket = (int)(latencyMs / LATENCY_BUCKET_MS);
+    if (latencyBucket < 0) latencyBucket = 0;
+    if (latencyBucket >= LATENCY_BUCKETS) latencyBucket = LATENCY_BUCKETS - 1;
+    stats->latencyBuckets[latencyBucket]++;
+    stats->latencySum += latencyMs;
+    stats->judgments[judgment]++;
+    stats->presses++;
+}
+
+// Function to read a latency percentile, in ms, from the histogram
+static double LatencyPercentile(const TimingStats* stats, double fraction) {
+    long wanted = (long)ceil(stats->presses * fraction), seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats->latencyBuckets[i];
+        if (seen >= wanted && seen > 0) return (i + 1) * LATENCY_BUCKET_MS;
+    }
+    return LATENCY_BUCKETS * LATENCY_BUCKET_MS;
+}
+
+static void PrintTimingReport(const TimingStats* stats) {
+    long peak = 1;
+    int buckets = 2 * ERROR_RANGE_MS / ERROR_BUCKET_MS + 2;
+    for (int i = 0; i < buckets; i++) if (stats->errorBuckets[i] > peak) peak = stats->errorBuckets[i];
+
+    printf("timing error (judged time - hit time):\n");
+    for (int i = 0; i < buckets; i++) {
+        char label[24];
+        if (i == 0) snprintf(label, sizeof(label), "< %d", -ERROR_RANGE_MS);
+        else if (i == buckets - 1) snprintf(label, sizeof(label), ">= %d", ERROR_RANGE_MS);
+        else snprintf(label, sizeof(label), "%d..%d", -ERROR_RANGE_MS + (i - 1) * ERROR_BUCKET_MS, -ERROR_RANGE_MS + i * ERROR_BUCKET_MS);
+        int bar = (int)(50 * stats->errorBuckets[i] / peak);
+        printf("  %10s ms %8ld %.*s\n", label, stats->errorBuckets[i], bar, "##################################################");
+    }
+
+    printf("input-to-judgment latency:\n");
+    for (int i = 0; i < 20; i++) {
+        long count = 0;
+        for (int j = (int)(i / LATENCY_BUCKET_MS); j < (int)((i + 1) / LATENCY_BUCKET_MS) && j < LATENCY_BUCKETS; j++) count += stats->latencyBuckets[j];
+        int bar = (int)(50.0 * count / (stats->presses > 0 ? stats->presses : 1));
+        printf("  %4d..%-3d ms %8ld %.*s\n", i, i + 1, count, bar, "##################################################");
+    }
+}
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    double pollRate = SIM_TICK_RATE;
+    bool timingReport = false;
+    int option;
+    while ((option = getopt(argc, argv, "p:t")) != -1) {
+        switch (option) {
+            case 'p': pollRate = atof(optarg); break;
+            case 't': timingReport = true; break;
+            default: pollRate = 0; break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    int matches = argc > 1 ? atoi(argv[1]) : DEFAULT_MATCHES;
+    unsigned int seed = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 1;
+    if (matches <= 0 || pollRate <= 0) {
+        fprintf(stderr, "usage: %s [-p poll_hz] [-t] [matches] [seed] [chart]\n", argv[0]);
+        return 1;
+    }
+
+    Chart chart;
+    bool useChart = argc > 3;
+    if (useChart && !ChartOpen(&chart, argv[3])) {
+        fprintf(stderr, "cannot open chart %s\n", argv[3]);
+        return 1;
+    }
+
+    srand(seed);
+
+    long long totalSteps = 0; // Ticks simulated, stepped or skipped
+    long long totalScore = 0;
+    double totalMatchTime = 0.0;
+    int wins[3] = {0}; // left, right, draw/timeout
+    static TimingStats timing;
+
+    SimState sim;
+    double start = NowSeconds();
+
+    for (int m = 0; m < matches; m++) {
+        SimInit(&sim, seed + (unsigned int)m);
+        if (useChart) SimUseChart(&sim, &chart);
+        Bot bots[2] = {
+            { .aimError = RandomRange(-BOT_AIM_ERROR, BOT_AIM_ERROR) / ARROW_SPEED },
+            { .aimError = RandomRange(-BOT_AIM_ERROR, BOT_AIM_ERROR) / ARROW_SPEED }
+        };
+
+        while (!sim.over && sim.time < MAX_MATCH_TIME) {
+            // Run straight up to the first step either bot might press in, or
+            // that spawns an arrow one might press next
+            int pressTick = SimNextEventTick(&sim);
+            if (pressTick > SIM_TICKS(MAX_MATCH_TIME)) pressTick = SIM_TICKS(MAX_MATCH_TIME);
+            for (int p = 0; p < 2; p++) {
+                int tick = BotEarliestTick(&bots[p], &sim.players[p], sim.tick + 1, 1.0 / pollRate);
+                if (tick < pressTick) pressTick = tick;
+            }
+            SimAdvance(&sim, pressTick - 1);
+            if (sim.over) break;
+
+            // Decide on the time the coming step will judge at
+            float stepTime = (sim.tick + 1) * SIM_DT;
+            BotPressInfo info[2];
+            SimInput input;
+            for (int p = 0; p < 2; p++) input.pressedDir[p] = BotPress(&bots[p], &sim.players[p], stepTime, 1.0 / pollRate, &info[p]);
+            SimStep(&sim, &input);
+            for (int p = 0; p < 2; p++) {
+                if (input.pressedDir[p] != SIM_NO_PRESS) RecordPress(&timing, &info[p], sim.time, sim.judged[p]);
+            }
+        }
+        totalSteps += sim.tick;
+
+        totalMatchTime += sim.time;
+        totalScore += sim.players[0].score + sim.players[1].score;
+        if (sim.players[1].health <= 0 && sim.players[0].health > 0) wins[0]++;
+        else if (sim.players[0].health <= 0 && sim.players[1].health > 0) wins[1]++;
+        else wins[2]++;
+    }
+
+    double elapsed = NowSeconds() - start;
+
+    printf("matches:        %d\n", matches);
+    printf("wall time:      %.3f s\n", elapsed);
+    printf("matches/sec:    %.0f\n", matches / elapsed);
+    printf("ticks/sec:      %.0f simulated\n", totalSteps / elapsed);
+    printf("avg match time: %.1f s simulated (%.0fx real time)\n", totalMatchTime / matches, totalMatchTime / elapsed);
+    printf("results:        left %d, right %d, draw %d\n", wins[0], wins[1], wins[2]);
+    printf("avg score:      %.0f\n", (double)totalScore / (2.0 * matches));
+    printf("input:          polled at %.0f Hz, judged at %d Hz ticks\n", pollRate, SIM_TICK_RATE);
+    printf("judgments:      perfect %ld, good %ld, miss %ld\n", timing.judgments[JUDGE_PERFECT], timing.judgments[JUDGE_GOOD], timing.judgments[JUDGE_MISS]);
+    printf("latency:        mean %.2f ms, p50 %.1f, p99 %.1f, max %.1f\n", timing.presses > 0 ? timing.latencySum / timing.presses : 0.0,
+           LatencyPercentile(&timing, 0.5), LatencyPercentile(&timing, 0.99), LatencyPercentile(&timing, 1.0));
+    if (timingReport) PrintTimingReport(&timing);
+
+    if (useChart) ChartClose(&chart);
+
+    return 0;
+}
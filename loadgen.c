@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+
+#define PROTO_DECODER_SIZE 512
+#include "protocol.h"
+#include "channel.h"
+#include "sim.h"
+
+// Synthetic load generator for the match server: opens N bot connections,
+// runs the ID/READY/START handshake, then replays game traffic and reports
+// throughput and round-trip latency percentiles measured with PING/PONG.
+// With -u the bots speak the UDP transport instead, through a simulated link
+// that drops, delays and reorders packets both ways, so the reliability layer
+// can be exercised on loopback.
+
+#define PORT 8080
+#define MAX_EVENTS 1024
+#define CONNECT_BATCH 256  // Connections opened per loop pass so the accept backlog keeps up
+#define SETUP_TIMEOUT_MS 60000
+#define SETTLE_MS 1000     // After the run, time for judgments still in flight to arrive
+
+typedef struct {
+    int socket;
+    int id;
+    int64_t snapshot_tick; // Newest snapshot seen; UDP repeats one until it is acked
+    bool started;
+    bool gone;
+    uint64_t start_ns; // When START arrived, match ticks count from here
+    ProtoDecoder in;
+
+    // UDP only
+    Channel channel;
+    struct sockaddr_in peer; // The lobby, then the worker serving the match
+    uint64_t last_sent_ns;
+    uint64_t last_heard_ns;
+} Connection;
+
+// A packet the simulated link is holding back
+typedef struct {
+    uint64_t due_ns;
+    Connection* conn;
+    bool outgoing;  // To the server; otherwise from it
+    struct sockaddr_in from;
+    uint16_t len;
+    uint8_t* data;
+} Delayed;
+
+// Simulated network between the UDP bots and their sockets: each packet,
+// either way, is dropped with probability `loss`, or held back for `latency`
+// plus a uniform share of `jitter`, which also reorders packets
+typedef struct {
+    double loss;
+    uint64_t latency_ns;
+    uint64_t jitter_ns;
+    Delayed* heap;  // Min-heap by due_ns
+    size_t count;
+    size_t capacity;
+    long dropped;
+    long delayed;
+} Link;
+
+typedef struct {
+    uint32_t* values; // Round trips in microseconds
+    size_t count;
+    size_t capacity;
+} Samples;
+
+typedef struct {
+    long inputs_sent;
+    long pings_sent;
+    long snapshots_received;
+    long judgments_received;
+    long pongs_received;
+    long own_judgments; // Judgments of this bot's own presses, to check none went missing
+    long own_rejected;  // Of those, presses the server dropped unjudged
+    long disconnects;
+} Counters;
+
+static Samples rtt = {0};
+static Counters counters = {0};
+static bool udp = false;
+static Link wire = {0};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void add_sample(Samples* samples, uint32_t value) {
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 4096;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(uint32_t));
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int compare_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const Samples* samples, double p) {
+    if (samples->count == 0) return 0;
+    size_t index = (size_t)(p * (samples->count - 1) + 0.5);
+    return samples->values[index];
+}
+
+// Exponential inter-arrival time for a Poisson process of the given rate
+static double next_interval(double rate) {
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return -log(u) / rate;
+}
+
+static void receive_packet(Connection* conn, const struct sockaddr_in* from, const uint8_t* data, size_t len, int* started);
+
+static void wire_push(const Delayed* delayed) {
+    if (wire.count == wire.capacity) {
+        wire.capacity = wire.capacity ? wire.capacity * 2 : 4096;
+        wire.heap = realloc(wire.heap, wire.capacity * sizeof(Delayed));
+    }
+    size_t i = wire.count++;
+    while (i > 0 && wire.heap[(i - 1) / 2].due_ns > delayed->due_ns) {
+        wire.heap[i] = wire.heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    wire.heap[i] = *delayed;
+}
+
+static Delayed wire_pop(void) {
+    Delayed top = wire.heap[0];
+    Delayed last = wire.heap[--wire.count];
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= wire.count) break;
+        if (child + 1 < wire.count && wire.heap[child + 1].due_ns < wire.heap[child].due_ns) child++;
+        if (wire.heap[child].due_ns >= last.due_ns) break;
+        wire.heap[i] = wire.heap[child];
+        i = child;
+    }
+    if (wire.count > 0) wire.heap[i] = last;
+    return top;
+}
+
+static void wire_deliver(Connection* conn, bool outgoing, const struct sockaddr_in* from, const uint8_t* data, size_t len, int* started) {
+    if (conn->gone) return;
+    if (outgoing) sendto(conn->socket, data, len, 0, (const struct sockaddr*)&conn->peer, sizeof(conn->peer));
+    else receive_packet(conn, from, data, len, started);
+}
+
+// Function to put a packet on the simulated link, one way or the other
+static void wire_transmit(Connection* conn, bool outgoing, const struct sockaddr_in* from, const uint8_t* data, size_t len, int* started) {
+    if (wire.loss > 0 && rand() < wire.loss * ((double)RAND_MAX + 1.0)) {
+        wire.dropped++;
+        return;
+    }
+    uint64_t delay = wire.latency_ns + (wire.jitter_ns > 0 ? (uint64_t)(rand() / ((double)RAND_MAX + 1.0) * wire.jitter_ns) : 0);
+    if (delay == 0) {
+        wire_deliver(conn, outgoing, from, data, len, started);
+        return;
+    }
+
+    Delayed delayed = { .due_ns = now_ns() + delay, .conn = conn, .outgoing = outgoing, .len = (uint16_t)len, .data = malloc(len) };
+    if (from != NULL) delayed.from = *from;
+    memcpy(delayed.data, data, len);
+    wire_push(&delayed);
+    wire.delayed++;
+}
+
+// Function to hand over every held packet whose time has come
+static void wire_run(int* started) {
+    uint64_t now = now_ns();
+    while (wire.count > 0 && wire.heap[0].due_ns <= now) {
+        Delayed delayed = wire_pop();
+        wire_deliver(delayed.conn, delayed.outgoing, &delayed.from, delayed.data, delayed.len, started);
+        free(delayed.data);
+    }
+}
+
+// Function to send a UDP bot's next packet: its unacked messages plus `unreliable`, if any
+static void send_packet(Connection* conn, const Message* unreliable, int* started) {
+    uint8_t packet[CHANNEL_PACKET_SIZE];
+    size_t len = ChannelWrite(&conn->channel, packet, unreliable, unreliable != NULL ? 1 : 0, NULL, now_ns());
+    conn->last_sent_ns = now_ns();
+    wire_transmit(conn, true, NULL, packet, len, started);
+}
+
+static void send_message(Connection* conn, const Message* msg, int* started) {
+    if (udp) {
+        // Each new input goes out at once, together with every earlier one still unacked
+        if (!ChannelReliable(msg->header.type)) send_packet(conn, msg, started);
+        else if (ChannelSend(&conn->channel, msg)) send_packet(conn, NULL, started);
+        return;
+    }
+    // Messages are tiny and loopback drains fast, so a rare short write is just dropped
+    send(conn->socket, msg, msg->header.length, MSG_NOSIGNAL);
+}
+
+// Function to stop using a bot whose server side is gone
+static void drop_connection(int epoll_fd, Connection* conn, int* started) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL);
+    if (conn->started) (*started)--;
+    conn->started = false;
+    conn->gone = true;
+    counters.disconnects++;
+}
+
+static void handle_message(Connection* conn, const Message* msg, int* started) {
+    switch (msg->header.type) {
+        case MSG_ID: {
+            if (conn->id == msg->id.id) break;  // The lobby repeats it for every hello, the worker sends it again
+            conn->id = msg->id.id;
+            Message ready;
+            ProtoInit(&ready, MSG_READY);
+            send_message(conn, &ready, started);
+            break;
+        }
+        case MSG_START:
+            if (!conn->started) {
+                conn->started = true;
+                conn->start_ns = now_ns();
+                (*started)++;
+            }
+            break;
+        case MSG_SNAPSHOT:
+            if (msg->snapshot.tick <= conn->snapshot_tick) break;
+            conn->snapshot_tick = msg->snapshot.tick;
+            counters.snapshots_received++;
+            break;
+        case MSG_JUDGMENT:
+            counters.judgments_received++;
+            if (msg->judgment.player == conn->id) counters.own_judgments++;
+            if (msg->judgment.player == conn->id && msg->judgment.result == PROTO_REJECTED) counters.own_rejected++;
+            break;
+        case MSG_PONG:
+            counters.pongs_received++;
+            add_sample(&rtt, (uint32_t)((now_ns() - msg->ping.timestamp) / 1000));
+            break;
+    }
+}
+
+// Function to take a packet off the link. Until the channel has heard from
+// the server, a packet carrying our session from another address is the
+// worker that took the match, and later sends go there.
+static void receive_packet(Connection* conn, const struct sockaddr_in* from, const uint8_t* data, size_t len, int* started) {
+    bool from_peer = from->sin_addr.s_addr == conn->peer.sin_addr.s_addr && from->sin_port == conn->peer.sin_port;
+    if (!from_peer && conn->channel.heard) return;
+    Message messages[CHANNEL_MAX_MESSAGES];
+    int count = ChannelRead(&conn->channel, data, len, now_ns(), messages, CHANNEL_MAX_MESSAGES);
+    if (count < 0) return;
+    if (!from_peer) conn->peer = *from;
+    conn->last_heard_ns = now_ns();
+    for (int i = 0; i < count; i++) handle_message(conn, &messages[i], started);
+}
+
+// Function to read everything pending on a connection, false once it is gone
+static bool drain(int epoll_fd, Connection* conn, int* started) {
+    if (udp) {
+        uint8_t packet[CHANNEL_PACKET_SIZE];
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t received;
+        while ((received = recvfrom(conn->socket, packet, sizeof(packet), 0, (struct sockaddr*)&from, &from_len)) > 0) {
+            wire_transmit(conn, false, &from, packet, received, started);
+            from_len = sizeof(from);
+        }
+        return true;
+    }
+
+    while (true) {
+        size_t space;
+        uint8_t* dst = ProtoDecoderSpace(&conn->in, &space);
+        ssize_t received = recv(conn->socket, dst, space, 0);
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (received <= 0) {
+            drop_connection(epoll_fd, conn, started);
+            return false;
+        }
+        ProtoDecoderCommit(&conn->in, received);
+
+        Message msg;
+        while (ProtoDecoderNext(&conn->in, &msg) == 1) handle_message(conn, &msg, started);
+    }
+}
+
+// Function to keep every UDP bot's channel going between messages: resend
+// what is unacked, answer owed acks, keep idle bots alive, notice dead ones
+static void service_udp(int epoll_fd, Connection* conns, int count, int* started) {
+    uint64_t now = now_ns();
+    for (int i = 0; i < count; i++) {
+        Connection* conn = &conns[i];
+        if (conn->socket == -1 || conn->gone) continue;
+        if (now - conn->last_heard_ns > CHANNEL_TIMEOUT_MS * 1000000ull) {
+            drop_connection(epoll_fd, conn, started);
+            continue;
+        }
+        uint64_t idle = now - conn->last_sent_ns;
+        bool owed = ChannelPending(&conn->channel) || conn->channel.ackOwed;
+        if ((owed && idle >= CHANNEL_RESEND_MS * 1000000ull) || idle >= CHANNEL_KEEPALIVE_MS * 1000000ull) send_packet(conn, NULL, started);
+    }
+}
+
+// Function to move everything due: held packets, socket reads and UDP upkeep
+static void pump(int epoll_fd, Connection* conns, int count, int* started, int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    for (int i = 0; i < n; i++) drain(epoll_fd, events[i].data.ptr, started);
+    if (udp) {
+        wire_run(started);
+        service_udp(epoll_fd, conns, count, started);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-i presses/s per player] [-p pings/s per player] [-s seed]\n"
+                    "       [-u [-l loss %%] [-L latency ms] [-j jitter ms]] [host]\n", name);
+}
+
+int main(int argc, char** argv) {
+    int count = 2000;
+    int seconds = 10;
+    double input_rate = 2.0;
+    double ping_rate = 1.0;
+    unsigned int seed = 1;
+    double loss_percent = 0.0, latency_ms = 0.0, jitter_ms = 0.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:i:p:s:ul:L:j:")) != -1) {
+        switch (opt) {
+            case 'c': count = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'i': input_rate = atof(optarg); break;
+            case 'p': ping_rate = atof(optarg); break;
+            case 's': seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+            case 'u': udp = true; break;
+            case 'l': loss_percent = atof(optarg); break;
+            case 'L': latency_ms = atof(optarg); break;
+            case 'j': jitter_ms = atof(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    const char* host = optind < argc ? argv[optind] : "127.0.0.1";
+    if (count < 2 || count % 2 != 0 || seconds <= 0 || input_rate < 0 || ping_rate < 0) {
+        fprintf(stderr, "connections must be even and >= 2, rates >= 0\n");
+        usage(argv[0]);
+        return 1;
+    }
+    if (loss_percent < 0 || loss_percent >= 100 || latency_ms < 0 || jitter_ms < 0 || (!udp && (loss_percent > 0 || latency_ms > 0 || jitter_ms > 0))) {
+        fprintf(stderr, "the simulated link needs -u, loss in [0, 100), latency and jitter >= 0\n");
+        usage(argv[0]);
+        return 1;
+    }
+    wire.loss = loss_percent / 100.0;
+    wire.latency_ns = (uint64_t)(latency_ms * 1e6);
+    wire.jitter_ns = (uint64_t)(jitter_ms * 1e6);
+    srand(seed);
+
+    signal(SIGPIPE, SIG_IGN);
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    struct sockaddr_in server_addr = {0};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(PORT);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid address\n");
+        return 1;
+    }
+
+    Connection* conns = calloc(count, sizeof(Connection));
+    int epoll_fd = epoll_create1(0);
+    int opened = 0, started = 0, failed = 0;
+
+    // Phase 1: connect every bot and wait for every match to start
+    uint64_t setup_start = now_ns();
+    while (started + failed + (int)counters.disconnects < count && (now_ns() - setup_start) / 1000000 < SETUP_TIMEOUT_MS) {
+        for (int i = 0; i < CONNECT_BATCH && opened < count; i++, opened++) {
+            Connection* conn = &conns[opened];
+            conn->socket = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+            // UDP bots stay unconnected: the match is served from another port than the lobby's
+            if (conn->socket == -1 || (!udp && connect(conn->socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1)) {
+                perror("connect");
+                if (conn->socket != -1) close(conn->socket);
+                conn->socket = -1;
+                failed++;
+                continue;
+            }
+            fcntl(conn->socket, F_SETFL, fcntl(conn->socket, F_GETFL, 0) | O_NONBLOCK);
+            if (!udp) {
+                // Like the client: each press and ping goes out at once, not behind Nagle
+                int nodelay = 1;
+                setsockopt(conn->socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+            }
+            ProtoDecoderReset(&conn->in);
+            conn->snapshot_tick = -1;
+
+            struct epoll_event ev = { .events = EPOLLIN, .data.ptr = conn };
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->socket, &ev);
+
+            if (udp) {
+                // The server's lobby pairs the bot when this empty first packet arrives
+                conn->peer = server_addr;
+                // Sessions differ per run, not per seed: the lobby ignores a session it paired moments ago
+                ChannelInit(&conn->channel, ((uint32_t)setup_start ^ (uint32_t)getpid() << 16) + (uint32_t)opened);
+                conn->last_heard_ns = now_ns();
+                send_packet(conn, NULL, &started);
+            }
+        }
+
+        pump(epoll_fd, conns, opened, &started, opened < count ? 0 : (udp ? 1 : 100));
+    }
+
+    double setup_ms = (now_ns() - setup_start) / 1e6;
+    printf("handshake:   %d/%d bots in started matches after %.0f ms (%d failed to connect)\n", started, count, setup_ms, failed);
+
+    // Phase 2: Poisson-timed key presses (INPUT) and latency probes (PING) across all bots
+    uint64_t run_start = now_ns();
+    uint64_t run_end = run_start + (uint64_t)seconds * 1000000000ull;
+    double next_input = input_rate > 0 ? next_interval(input_rate * count) : INFINITY;
+    double next_ping = ping_rate > 0 ? next_interval(ping_rate * count) : INFINITY;
+
+    while (now_ns() < run_end) {
+        double elapsed = (now_ns() - run_start) / 1e9;
+
+        while (next_input <= elapsed) {
+            next_input += next_interval(input_rate * count);
+            Connection* conn = &conns[rand() % count];
+            if (!conn->started) continue;
+
+            // Presses land at random, so the server judges a realistic mix of hits and misses
+            Message input;
+            ProtoInit(&input, MSG_INPUT);
+            input.input.tick = (uint32_t)((now_ns() - conn->start_ns) * SIM_TICK_RATE / 1000000000ull);
+            input.input.lane = (uint8_t)(rand() % SIM_LANES);
+            send_message(conn, &input, &started);
+            counters.inputs_sent++;
+        }
+
+        while (next_ping <= elapsed) {
+            next_ping += next_interval(ping_rate * count);
+            Connection* conn = &conns[rand() % count];
+            if (!conn->started) continue;
+
+            Message ping;
+            ProtoInit(&ping, MSG_PING);
+            ping.ping.timestamp = now_ns();
+            send_message(conn, &ping, &started);
+            counters.pings_sent++;
+        }
+
+        pump(epoll_fd, conns, count, &started, 1);
+    }
+
+    // Rates cover the run only; the settle just lets late judgments land
+    double run_s = (now_ns() - run_start) / 1e9;
+    Counters run = counters;
+    uint64_t settle_end = now_ns() + SETTLE_MS * 1000000ull + 2 * (wire.latency_ns + wire.jitter_ns);
+    while (now_ns() < settle_end) pump(epoll_fd, conns, count, &started, 1);
+    qsort(rtt.values, rtt.count, sizeof(uint32_t), compare_u32);
+
+    printf("duration:    %.1f s, %d bots still connected, %ld disconnects\n", run_s, started, counters.disconnects);
+    printf("sent:        %.0f msg/s (%.0f inputs/s, %.0f pings/s)\n",
+           (run.inputs_sent + run.pings_sent) / run_s, run.inputs_sent / run_s, run.pings_sent / run_s);
+    long received = run.snapshots_received + run.judgments_received + run.pongs_received;
+    printf("received:    %.0f msg/s (%.0f snapshots/s, %.0f judgments/s, %.0f pongs/s)\n",
+           received / run_s, run.snapshots_received / run_s,
+           run.judgments_received / run_s, run.pongs_received / run_s);
+    printf("judged:      %ld of %ld presses came back, %ld of them rejected (after a match ended, or past the per-tick queue)\n",
+           counters.own_judgments, counters.inputs_sent, counters.own_rejected);
+    printf("rtt:         %zu samples, p50 %u us, p99 %u us, p999 %u us, max %u us\n",
+           rtt.count, percentile(&rtt, 0.50), percentile(&rtt, 0.99), percentile(&rtt, 0.999),
+           rtt.count ? rtt.values[rtt.count - 1] : 0);
+
+    if (udp) {
+        ChannelStats total = {0};
+        double rtt_sum = 0.0;
+        int rtt_count = 0;
+        for (int i = 0; i < count; i++) {
+            const ChannelStats* stats = &conns[i].channel.stats;
+            total.packetsSent += stats->packetsSent;
+            total.packetsReceived += stats->packetsReceived;
+            total.packetsAcked += stats->packetsAcked;
+            total.stale += stats->stale;
+            total.resent += stats->resent;
+            total.overflows += stats->overflows;
+            if (stats->packetsAcked > 0) {
+                rtt_sum += stats->rttMs;
+                rtt_count++;
+            }
+        }
+        printf("udp:         %ld packets sent (%ld acked), %ld received (%ld stale), %ld reliable messages resent, %ld refused\n",
+               total.packetsSent, total.packetsAcked, total.packetsReceived, total.stale, total.resent, total.overflows);
+        printf("link:        %.1f%% loss, %.0f ms + %.0f ms jitter each way: %ld packets dropped, %ld delayed, channel rtt %.1f ms (acks wait for the server tick)\n",
+               loss_percent, latency_ms, jitter_ms, wire.dropped, wire.delayed, rtt_count ? rtt_sum / rtt_count : 0.0);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (conns[i].socket > 0) close(conns[i].socket);
+    }
+    while (wire.count > 0) free(wire_pop().data);
+    free(wire.heap);
+    free(conns);
+    free(rtt.values);
+    return 0;
+}
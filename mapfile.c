@@ -0,0 +1,69 @@
+#include "mapfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef _WIN32
+
+// Function to map a file read-only; pages come in as they are first touched
+bool MapFile(MappedFile* file, const char* path) {
+    memset(file, 0, sizeof(*file));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    file->data = data;
+    file->size = (size_t)st.st_size;
+    return true;
+}
+
+void UnmapFile(MappedFile* file) {
+    if (file->data != NULL) munmap((void*)file->data, file->size);
+    memset(file, 0, sizeof(*file));
+}
+
+#else
+
+// No mmap here: read the whole file in one allocation instead
+bool MapFile(MappedFile* file, const char* path) {
+    memset(file, 0, sizeof(*file));
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) return false;
+
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    void* data = size > 0 ? malloc((size_t)size) : NULL;
+    bool ok = data != NULL && fread(data, 1, (size_t)size, in) == (size_t)size;
+    fclose(in);
+
+    if (!ok) {
+        free(data);
+        return false;
+    }
+    file->data = data;
+    file->size = (size_t)size;
+    return true;
+}
+
+void UnmapFile(MappedFile* file) {
+    free((void*)file->data);
+    memset(file, 0, sizeof(*file));
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef MAPFILE_H
+#define MAPFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Read-only view of a whole file: mmap where there is one, otherwise a
+// single allocation holding the file's contents
+typedef struct {
+    const void* data;
+    size_t size;
+} MappedFile;
+
+bool MapFile(MappedFile* file, const char* path);
+void UnmapFile(MappedFile* file);
+
+#endif
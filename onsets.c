@@ -0,0 +1,495 @@
+#include "raylib.h"
+#include "chart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+// Offline chart generator: decodes a track with raylib, finds note onsets with
+// a short-time FFT spectral-flux detector, estimates the tempo from the onset
+// envelope's autocorrelation and writes a chart the game can play.
+//
+// The STFT pass dominates the run time. It is split across threads by frame
+// range, and its inner loops (FFT butterflies, log power, flux) run on
+// 8-float GCC vector types. Those fill one AVX register, so the vector path is
+// only built with AVX2 enabled (-mavx2 or -march=native on a CPU that has
+// it); elsewhere GCC would pass them through memory, and it is left out in
+// favour of the scalar path.
+
+#define FFT_SIZE 1024
+#define FFT_BITS 10
+#define HOP_SIZE 512
+#define BINS (FFT_SIZE / 2)    // Nyquist bin dropped so band edges stay multiples of 8
+#define BANDS 4                // Frequency bands, one per lane
+#define LOG_COMPRESSION 100.0f // Flux is taken on log2(1 + C * power)
+#define PEAK_RADIUS 3          // Frames an onset must dominate on each side
+#define MEAN_RADIUS 16         // Frames in the adaptive threshold's moving mean
+#define THRESHOLD_STD 0.5f     // Threshold above the moving mean, in global standard deviations
+#define MIN_BPM 70.0
+#define MAX_BPM 180.0
+#define MAX_THREADS 64
+#define BENCH_RUNS 3
+
+#ifdef __AVX2__
+#define SIMD_BUILT true
+typedef float v8f __attribute__((vector_size(32), aligned(4)));
+typedef int32_t v8i __attribute__((vector_size(32), aligned(4)));
+#else
+#define SIMD_BUILT false
+#endif
+
+// Bins [bandEdges[b], bandEdges[b + 1]) make up band b: bass, low mids, high mids, highs
+static const int bandEdges[BANDS + 1] = { 0, 8, 32, 128, BINS };
+
+// Low to high bands map to left, down, up, right
+static const int bandLanes[BANDS] = { 2, 1, 0, 3 };
+
+typedef struct {
+    int bitrev[FFT_SIZE];
+    float window[FFT_SIZE];
+    float twiddleRe[FFT_SIZE]; // Stage with half-size h keeps its h twiddles at [h - 1, 2h - 1)
+    float twiddleIm[FFT_SIZE];
+} FftPlan;
+
+typedef struct {
+    const FftPlan* plan;
+    const float* samples;
+    int sampleCount;
+    int first, last;  // Frame range [first, last)
+    bool simd;
+    float* bandFlux;  // BANDS values per frame
+} StftJob;
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void FftPlanInit(FftPlan* plan) {
+    for (int i = 0; i < FFT_SIZE; i++) {
+        int r = 0;
+        for (int bit = 0; bit < FFT_BITS; bit++) r |= ((i >> bit) & 1) << (FFT_BITS - 1 - bit);
+        plan->bitrev[i] = r;
+        plan->window[i] = 0.5f - 0.5f * cosf(2.0f * PI * i / FFT_SIZE); // Hann
+    }
+    for (int half = 1; half < FFT_SIZE; half <<= 1) {
+        for (int j = 0; j < half; j++) {
+            plan->twiddleRe[half - 1 + j] = cosf(-PI * j / half);
+            plan->twiddleIm[half - 1 + j] = sinf(-PI * j / half);
+        }
+    }
+}
+
+// Function to approximate log2 from the float's exponent and a quadratic on
+// its mantissa; the scalar and vector versions compute exactly the same thing
+static inline float FastLog2(float x) {
+    union { float f; int32_t i; } u = { x };
+    float exponent = (float)(((u.i >> 23) & 255) - 127);
+    u.i = (u.i & 0x007FFFFF) | 0x3F800000;
+    float m = u.f;
+    return exponent + (-0.34484843f * m + 2.02466578f) * m - 0.67487759f;
+}
+
+#ifdef __AVX2__
+static inline v8f FastLog2x8(v8f x) {
+    v8i bits = (v8i)x;
+    v8f exponent = __builtin_convertvector(((bits >> 23) & 255) - 127, v8f);
+    v8f m = (v8f)((bits & 0x007FFFFF) | 0x3F800000);
+    return exponent + (-0.34484843f * m + 2.02466578f) * m - 0.67487759f;
+}
+#endif
+
+// Function to load one windowed frame into bit-reversed order, zero past the end of the track
+static void LoadFrame(const StftJob* job, int frame, float* re, float* im) {
+    const FftPlan* plan = job->plan;
+    int start = frame * HOP_SIZE;
+    for (int i = 0; i < FFT_SIZE; i++) {
+        float sample = start + i < job->sampleCount ? job->samples[start + i] : 0.0f;
+        re[plan->bitrev[i]] = sample * plan->window[i];
+        im[i] = 0.0f;
+    }
+}
+
+// Scalar baseline, kept out of the auto-vectorizer so the benchmark compares like with like
+__attribute__((optimize("no-tree-vectorize")))
+static void FftScalar(const FftPlan* plan, float* re, float* im) {
+    for (int half = 1; half < FFT_SIZE; half <<= 1) {
+        const float* wr = plan->twiddleRe + half - 1;
+        const float* wi = plan->twiddleIm + half - 1;
+        for (int k = 0; k < FFT_SIZE; k += 2 * half) {
+            for (int j = 0; j < half; j++) {
+                int a = k + j, b = a + half;
+                float tr = re[b] * wr[j] - im[b] * wi[j];
+                float ti = re[b] * wi[j] + im[b] * wr[j];
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+#ifdef __AVX2__
+// Same butterflies, eight at a time once a stage's groups are at least 8 wide
+static void FftSimd(const FftPlan* plan, float* re, float* im) {
+    for (int half = 1; half < FFT_SIZE; half <<= 1) {
+        const float* wr = plan->twiddleRe + half - 1;
+        const float* wi = plan->twiddleIm + half - 1;
+        for (int k = 0; k < FFT_SIZE; k += 2 * half) {
+            if (half < 8) {
+                for (int j = 0; j < half; j++) {
+                    int a = k + j, b = a + half;
+                    float tr = re[b] * wr[j] - im[b] * wi[j];
+                    float ti = re[b] * wi[j] + im[b] * wr[j];
+                    re[b] = re[a] - tr;
+                    im[b] = im[a] - ti;
+                    re[a] += tr;
+                    im[a] += ti;
+                }
+                continue;
+            }
+            for (int j = 0; j < half; j += 8) {
+                v8f* ra = (v8f*)(re + k + j);
+                v8f* ia = (v8f*)(im + k + j);
+                v8f* rb = (v8f*)(re + k + j + half);
+                v8f* ib = (v8f*)(im + k + j + half);
+                v8f twr = *(const v8f*)(wr + j);
+                v8f twi = *(const v8f*)(wi + j);
+                v8f tr = *rb * twr - *ib * twi;
+                v8f ti = *rb * twi + *ib * twr;
+                *rb = *ra - tr;
+                *ib = *ia - ti;
+                *ra += tr;
+                *ia += ti;
+            }
+        }
+    }
+}
+#endif
+
+// Function to turn a spectrum into log power and each band's positive change since `prev`
+__attribute__((optimize("no-tree-vectorize")))
+static void FluxScalar(const float* re, const float* im, float* logPower, const float* prev, float* bandFlux) {
+    for (int band = 0; band < BANDS; band++) {
+        float sum = 0.0f;
+        for (int bin = bandEdges[band]; bin < bandEdges[band + 1]; bin++) {
+            logPower[bin] = FastLog2(1.0f + LOG_COMPRESSION * (re[bin] * re[bin] + im[bin] * im[bin]));
+            float rise = logPower[bin] - prev[bin];
+            if (rise > 0.0f) sum += rise;
+        }
+        bandFlux[band] = sum;
+    }
+}
+
+#ifdef __AVX2__
+static void FluxSimd(const float* re, const float* im, float* logPower, const float* prev, float* bandFlux) {
+    for (int band = 0; band < BANDS; band++) {
+        v8f sum = {0};
+        for (int bin = bandEdges[band]; bin < bandEdges[band + 1]; bin += 8) {
+            v8f r = *(const v8f*)(re + bin);
+            v8f i = *(const v8f*)(im + bin);
+            v8f power = FastLog2x8(1.0f + LOG_COMPRESSION * (r * r + i * i));
+            *(v8f*)(logPower + bin) = power;
+            v8f rise = power - *(const v8f*)(prev + bin);
+            sum += (v8f)((v8i)rise & (rise > 0.0f)); // Keep only increases
+        }
+        bandFlux[band] = sum[0] + sum[1] + sum[2] + sum[3] + sum[4] + sum[5] + sum[6] + sum[7];
+    }
+}
+#else
+// Not built: main never asks for the vector path
+#define FftSimd FftScalar
+#define FluxSimd FluxScalar
+#endif
+
+// Function to run the STFT over one frame range. The frame before the range is
+// transformed first, so every range gives the same flux a single pass would.
+static void* StftWorker(void* arg) {
+    StftJob* job = arg;
+    float* buffers = aligned_alloc(32, 4 * FFT_SIZE * sizeof(float));
+    float* re = buffers;
+    float* im = buffers + FFT_SIZE;
+    float* logPower = buffers + 2 * FFT_SIZE;
+    float* prev = buffers + 3 * FFT_SIZE;
+    float scratch[BANDS];
+
+    memset(prev, 0, FFT_SIZE * sizeof(float));
+    for (int frame = job->first > 0 ? job->first - 1 : 0; frame < job->last; frame++) {
+        LoadFrame(job, frame, re, im);
+        float* flux = frame < job->first ? scratch : job->bandFlux + frame * BANDS;
+        if (job->simd) {
+            FftSimd(job->plan, re, im);
+            FluxSimd(re, im, logPower, prev, flux);
+        } else {
+            FftScalar(job->plan, re, im);
+            FluxScalar(re, im, logPower, prev, flux);
+        }
+        float* swap = prev;
+        prev = logPower;
+        logPower = swap;
+    }
+
+    free(buffers);
+    return NULL;
+}
+
+// Function to fill bandFlux for every frame using `threads` workers
+static void RunStft(const FftPlan* plan, const float* samples, int sampleCount, int frames, int threads, bool simd, float* bandFlux) {
+    pthread_t ids[MAX_THREADS];
+    StftJob jobs[MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        jobs[t] = (StftJob){
+            .plan = plan, .samples = samples, .sampleCount = sampleCount,
+            .first = (int)((long)frames * t / threads), .last = (int)((long)frames * (t + 1) / threads),
+            .simd = simd, .bandFlux = bandFlux
+        };
+        if (t > 0) pthread_create(&ids[t], NULL, StftWorker, &jobs[t]);
+    }
+    StftWorker(&jobs[0]);
+    for (int t = 1; t < threads; t++) pthread_join(ids[t], NULL);
+}
+
+// Function to pick onsets: local maxima of the total flux that clear a moving
+// mean by a fraction of the envelope's spread. Returns the onset count.
+static int PickOnsets(const float* envelope, int frames, int* onsets) {
+    double sum = 0.0, sumSq = 0.0;
+    for (int i = 0; i < frames; i++) {
+        sum += envelope[i];
+        sumSq += envelope[i] * envelope[i];
+    }
+    double mean = sum / frames;
+    float threshold = THRESHOLD_STD * (float)sqrt(fmax(sumSq / frames - mean * mean, 0.0));
+
+    int count = 0;
+    double window = 0.0; // Sum of envelope over [i - MEAN_RADIUS, i + MEAN_RADIUS]
+    for (int i = 0; i < MEAN_RADIUS && i < frames; i++) window += envelope[i];
+    for (int i = 0; i < frames; i++) {
+        if (i + MEAN_RADIUS < frames) window += envelope[i + MEAN_RADIUS];
+        if (i - MEAN_RADIUS - 1 >= 0) window -= envelope[i - MEAN_RADIUS - 1];
+        int lo = i - MEAN_RADIUS < 0 ? 0 : i - MEAN_RADIUS;
+        int hi = i + MEAN_RADIUS >= frames ? frames - 1 : i + MEAN_RADIUS;
+        float localMean = (float)(window / (hi - lo + 1));
+
+        if (envelope[i] < localMean + threshold) continue;
+        bool peak = true;
+        for (int j = i - PEAK_RADIUS; j <= i + PEAK_RADIUS && peak; j++) {
+            if (j >= 0 && j < frames && j != i && envelope[j] > envelope[i]) peak = false;
+        }
+        if (peak) onsets[count++] = i;
+    }
+    return count;
+}
+
+// Function to estimate tempo and beat phase from the envelope's autocorrelation,
+// weighting lags toward 120 BPM so half and double tempo lose close calls.
+// False when the track is too short to hold the slowest beat period.
+static bool EstimateTempo(const float* envelope, int frames, double framesPerSecond, double* bpm, double* firstBeat) {
+    int minLag = (int)(framesPerSecond * 60.0 / MAX_BPM);
+    int maxLag = (int)(framesPerSecond * 60.0 / MIN_BPM) + 1;
+    if (frames < maxLag + 2) return false;
+    double* score = calloc(maxLag + 2, sizeof(double));
+
+    int bestLag = minLag;
+    for (int lag = minLag; lag <= maxLag + 1; lag++) {
+        double acf = 0.0;
+        for (int i = lag; i < frames; i++) acf += envelope[i] * envelope[i - lag];
+        double octaves = log2((60.0 * framesPerSecond / lag) / 120.0);
+        score[lag] = acf / (frames - lag) * exp(-0.5 * octaves * octaves);
+        if (lag <= maxLag && score[lag] > score[bestLag]) bestLag = lag;
+    }
+
+    // Parabolic interpolation between neighbouring lags for a sub-frame period
+    double period = bestLag;
+    if (bestLag > minLag) {
+        double a = score[bestLag - 1], b = score[bestLag], c = score[bestLag + 1];
+        double denom = a - 2.0 * b + c;
+        if (denom < 0.0) period += 0.5 * (a - c) / denom;
+    }
+    free(score);
+
+    // Phase: the offset whose beat grid collects the most onset energy
+    double bestPhase = 0.0, bestEnergy = -1.0;
+    for (int phase = 0; phase < (int)period; phase++) {
+        double energy = 0.0;
+        for (double t = phase; t < frames; t += period) energy += envelope[(int)t];
+        if (energy > bestEnergy) {
+            bestEnergy = energy;
+            bestPhase = phase;
+        }
+    }
+
+    *bpm = 60.0 * framesPerSecond / period;
+    *firstBeat = bestPhase / framesPerSecond;
+    return true;
+}
+
+static int CompareNote(const void* a, const void* b) {
+    uint32_t x = ((const ChartNote*)a)->timeUs, y = ((const ChartNote*)b)->timeUs;
+    return (x > y) - (x < y);
+}
+
+static void Bench(const FftPlan* plan, const float* samples, int sampleCount, int frames, int threads, float* bandFlux) {
+    struct { const char* name; bool simd; int threads; } configs[] = {
+        { "scalar, 1 thread", false, 1 },
+        { "scalar, N threads", false, threads },
+        { "simd,   1 thread", true, 1 },
+        { "simd,   N threads", true, threads },
+    };
+    double baseline = 0.0;
+    printf("STFT + flux over %d frames, best of %d runs, N = %d\n", frames, BENCH_RUNS, threads);
+    if (!SIMD_BUILT) printf("  (built without AVX2, so no SIMD rows)\n");
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        if (configs[c].simd && !SIMD_BUILT) continue;
+        double best = 1e9;
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            double start = NowSeconds();
+            RunStft(plan, samples, sampleCount, frames, configs[c].threads, configs[c].simd, bandFlux);
+            double elapsed = NowSeconds() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        if (c == 0) baseline = best;
+        printf("  %-18s %8.1f ms  %5.2fx\n", configs[c].name, best * 1000.0, baseline / best);
+    }
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr, "usage: %s [-t threads] [-s] [-g min gap ms] [-l lead-in s] [-b] track output.chart\n"
+                    "  -s  scalar code path (default: SIMD, when built with AVX2)\n"
+                    "  -b  benchmark scalar/SIMD x 1/N threads, then write the chart as usual\n", name);
+}
+
+int main(int argc, char** argv) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    bool simd = true, bench = false;
+    double minGapMs = 120.0;  // Closer onsets are merged so the chart stays playable
+    double leadIn = 2.5;      // No notes before this, arrows need time to fall into view
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:sg:l:b")) != -1) {
+        switch (opt) {
+            case 't': threads = atoi(optarg); break;
+            case 's': simd = false; break;
+            case 'g': minGapMs = atof(optarg); break;
+            case 'l': leadIn = atof(optarg); break;
+            case 'b': bench = true; break;
+            default: Usage(argv[0]); return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        Usage(argv[0]);
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (!SIMD_BUILT) simd = false;
+    SetTraceLogLevel(LOG_WARNING);
+
+    // Decode and mix down to mono
+    double start = NowSeconds();
+    Wave wave = LoadWave(argv[optind]);
+    if (wave.frameCount == 0) {
+        fprintf(stderr, "cannot load %s\n", argv[optind]);
+        return 1;
+    }
+    float* interleaved = LoadWaveSamples(wave);
+    int sampleCount = (int)wave.frameCount;
+    float* samples = malloc(sampleCount * sizeof(float));
+    for (int i = 0; i < sampleCount; i++) {
+        float sum = 0.0f;
+        for (unsigned int ch = 0; ch < wave.channels; ch++) sum += interleaved[i * wave.channels + ch];
+        samples[i] = sum / wave.channels;
+    }
+    double sampleRate = wave.sampleRate;
+    UnloadWaveSamples(interleaved);
+    UnloadWave(wave);
+    double decodeTime = NowSeconds() - start;
+
+    // Spectral flux per band
+    FftPlan* plan = aligned_alloc(32, sizeof(FftPlan));
+    FftPlanInit(plan);
+    int frames = (sampleCount + HOP_SIZE - 1) / HOP_SIZE;
+    float* bandFlux = malloc((size_t)frames * BANDS * sizeof(float));
+    if (bench) Bench(plan, samples, sampleCount, frames, threads, bandFlux);
+
+    start = NowSeconds();
+    RunStft(plan, samples, sampleCount, frames, threads, simd, bandFlux);
+    double stftTime = NowSeconds() - start;
+
+    // Onsets and tempo from the summed envelope
+    start = NowSeconds();
+    float* envelope = malloc(frames * sizeof(float));
+    for (int i = 0; i < frames; i++) {
+        envelope[i] = 0.0f;
+        for (int band = 0; band < BANDS; band++) envelope[i] += bandFlux[i * BANDS + band];
+    }
+    double bandMean[BANDS] = {0}; // Wide high bands carry more flux, so lanes compare against each band's average
+    for (int i = 0; i < frames; i++) {
+        for (int band = 0; band < BANDS; band++) bandMean[band] += bandFlux[i * BANDS + band];
+    }
+    for (int band = 0; band < BANDS; band++) bandMean[band] = bandMean[band] / frames + 1e-9;
+    int* onsets = malloc(frames * sizeof(int));
+    int onsetCount = PickOnsets(envelope, frames, onsets);
+    double framesPerSecond = sampleRate / HOP_SIZE;
+    double bpm, firstBeat;
+    if (!EstimateTempo(envelope, frames, framesPerSecond, &bpm, &firstBeat)) {
+        fprintf(stderr, "%s is too short to find a tempo in, it needs at least %.1f s\n", argv[optind], 60.0 / MIN_BPM + 2.0 / framesPerSecond);
+        return 1;
+    }
+
+    // Each onset snaps to the nearest sixteenth of the beat grid and goes to the
+    // lane of its relatively strongest band; onsets inside the minimum gap are dropped
+    ChartNote* notes[CHART_LANES];
+    uint32_t noteCount[CHART_LANES] = {0};
+    for (int lane = 0; lane < CHART_LANES; lane++) notes[lane] = malloc((onsetCount + 1) * sizeof(ChartNote));
+    double step = 60.0 / bpm / 4.0;
+    double lastTime = -1e9;
+    int kept = 0;
+    for (int i = 0; i < onsetCount; i++) {
+        double time = onsets[i] / framesPerSecond;
+        time = firstBeat + round((time - firstBeat) / step) * step;
+        if (time < leadIn || (time - lastTime) * 1000.0 < minGapMs) continue;
+
+        const float* flux = bandFlux + onsets[i] * BANDS;
+        int strongest = 0;
+        for (int band = 1; band < BANDS; band++) {
+            if (flux[band] / bandMean[band] > flux[strongest] / bandMean[strongest]) strongest = band;
+        }
+        int lane = bandLanes[strongest];
+        notes[lane][noteCount[lane]++].timeUs = (uint32_t)(time * 1e6 + 0.5);
+        lastTime = time;
+        kept++;
+    }
+    for (int lane = 0; lane < CHART_LANES; lane++) qsort(notes[lane], noteCount[lane], sizeof(ChartNote), CompareNote);
+    double pickTime = NowSeconds() - start;
+
+    ChartTempo tempo = { .timeUs = (uint32_t)(firstBeat * 1e6 + 0.5), .beat = 0.0f, .bpm = (float)bpm };
+    bool saved = ChartSave(argv[optind + 1], &tempo, 1, (const ChartNote* const*)notes, noteCount);
+
+    printf("track:    %.1f s at %.0f Hz, %d frames\n", sampleCount / sampleRate, sampleRate, frames);
+    printf("tempo:    %.1f BPM, first beat at %.3f s\n", bpm, firstBeat);
+    printf("notes:    %d onsets, %d kept (left %u, down %u, up %u, right %u)\n",
+           onsetCount, kept, noteCount[2], noteCount[1], noteCount[0], noteCount[3]);
+    printf("time:     decode %.0f ms, stft %.0f ms (%s, %d thread%s), picking %.1f ms\n",
+           decodeTime * 1000.0, stftTime * 1000.0, simd ? "simd" : "scalar", threads, threads == 1 ? "" : "s", pickTime * 1000.0);
+
+    for (int lane = 0; lane < CHART_LANES; lane++) free(notes[lane]);
+    free(onsets);
+    free(envelope);
+    free(bandFlux);
+    free(plan);
+    free(samples);
+
+    if (!saved) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    return 0;
+}
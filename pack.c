@@ -0,0 +1,57 @@
+#include "pack.h"
+#include "mapfile.h"
+#include <string.h>
+
+// Function to check the header and that every entry lies inside the file
+static bool PackValid(const uint8_t* data, size_t size) {
+    if (size < sizeof(PackHeader)) return false;
+    const PackHeader* header = (const PackHeader*)data;
+    if (memcmp(header->magic, PACK_MAGIC, 4) != 0 || header->version != PACK_VERSION) return false;
+    if (header->entryOffset % 4 != 0 || header->entryOffset > size) return false;
+    if ((uint64_t)header->entryCount * sizeof(PackEntry) > size - header->entryOffset) return false;
+
+    const PackEntry* entries = (const PackEntry*)(data + header->entryOffset);
+    for (uint32_t i = 0; i < header->entryCount; i++) {
+        const PackEntry* entry = &entries[i];
+        if (memchr(entry->name, '\0', PACK_NAME_LENGTH) == NULL) return false;
+        if (entry->offset % PACK_ALIGN != 0 || entry->offset > size || entry->size > size - entry->offset) return false;
+        if (entry->type == PACK_PIXELS && (uint64_t)entry->width * entry->height * 4 != entry->size) return false;
+    }
+    return true;
+}
+
+// Function to map an archive; entries are checked once here, so lookups can trust them
+bool PackOpen(Pack* pack, const char* path) {
+    memset(pack, 0, sizeof(*pack));
+    MappedFile file;
+    if (!MapFile(&file, path)) return false;
+    if (!PackValid(file.data, file.size)) {
+        UnmapFile(&file);
+        return false;
+    }
+
+    pack->data = file.data;
+    pack->size = file.size;
+    pack->header = file.data;
+    pack->entries = (const PackEntry*)(pack->data + pack->header->entryOffset);
+    return true;
+}
+
+void PackClose(Pack* pack) {
+    MappedFile file = { pack->data, pack->size };
+    if (pack->data != NULL) UnmapFile(&file);
+    memset(pack, 0, sizeof(*pack));
+}
+
+// Function to look an asset up by its loose file name, NULL if the pack lacks it
+const PackEntry* PackFind(const Pack* pack, const char* name) {
+    if (pack == NULL || pack->header == NULL) return NULL;
+    for (uint32_t i = 0; i < pack->header->entryCount; i++) {
+        if (strcmp(pack->entries[i].name, name) == 0) return &pack->entries[i];
+    }
+    return NULL;
+}
+
+const void* PackEntryData(const Pack* pack, const PackEntry* entry) {
+    return pack->data + entry->offset;
+}
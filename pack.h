@@ -0,0 +1,51 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Asset archive. One file holds every asset the game loads at startup:
+// images already decoded to RGBA8 pixels (optionally pre-scaled), other
+// files as their raw bytes. It is mapped and used in place like a chart;
+// each entry starts on a PACK_ALIGN boundary.
+
+#define PACK_MAGIC "DPAK"
+#define PACK_VERSION 1
+#define PACK_NAME_LENGTH 48
+#define PACK_ALIGN 64
+
+typedef enum {
+    PACK_RAW = 0,   // File contents as they were on disk
+    PACK_PIXELS = 1 // Decoded image, width * height RGBA8 pixels
+} PackEntryType;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t entryOffset; // Byte offset of PackEntry[entryCount]
+} PackHeader;
+
+typedef struct {
+    char name[PACK_NAME_LENGTH]; // The loose file's name, NUL-terminated
+    uint32_t type;
+    uint32_t width, height;      // PACK_PIXELS only
+    float scale;                 // PACK_PIXELS only: size relative to the source image
+    uint32_t offset;
+    uint32_t size;
+} PackEntry;
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    const PackHeader* header;
+    const PackEntry* entries;
+} Pack;
+
+bool PackOpen(Pack* pack, const char* path);
+void PackClose(Pack* pack);
+const PackEntry* PackFind(const Pack* pack, const char* name);
+const void* PackEntryData(const Pack* pack, const PackEntry* entry);
+
+#endif
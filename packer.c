@@ -0,0 +1,106 @@
+#include "raylib.h"
+#include "pack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Builds an asset archive (pack.h). Images are decoded to RGBA8 here, and
+// "file.png@0.5" stores them pre-scaled, so loading them costs no decode and
+// no resize. Everything else is stored as it is on disk.
+//
+//   ./packer assets.pak backd.png darrow.png@0.33 baseg.png@0.5 bloodymary.mp3
+
+#define MAX_ENTRIES 64
+
+static uint32_t AlignUp(uint32_t value) {
+    return (value + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+// Function to load one input: decoded pixels for images, raw bytes otherwise
+static bool LoadEntry(const char* arg, PackEntry* entry, void** data) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s", arg);
+    float scale = 1.0f;
+    char* at = strrchr(path, '@');
+    if (at != NULL) {
+        *at = '\0';
+        scale = (float)atof(at + 1);
+        if (scale <= 0.0f) return false;
+    }
+
+    const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (strlen(name) >= PACK_NAME_LENGTH) return false;
+    memset(entry, 0, sizeof(*entry));
+    strcpy(entry->name, name);
+
+    if (IsFileExtension(path, ".png;.jpg;.bmp;.tga;.qoi")) {
+        Image image = LoadImage(path);
+        if (image.data == NULL) return false;
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        if (scale != 1.0f) ImageResize(&image, (int)(image.width * scale + 0.5f), (int)(image.height * scale + 0.5f));
+        entry->type = PACK_PIXELS;
+        entry->width = (uint32_t)image.width;
+        entry->height = (uint32_t)image.height;
+        entry->scale = scale;
+        entry->size = entry->width * entry->height * 4;
+        *data = image.data;
+        return true;
+    }
+
+    if (at != NULL) return false; // Only images can be scaled
+    int size = 0;
+    *data = LoadFileData(path, &size);
+    entry->type = PACK_RAW;
+    entry->size = (uint32_t)size;
+    return *data != NULL;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc - 2 > MAX_ENTRIES) {
+        fprintf(stderr, "usage: %s out.pak file[@scale]...\n", argv[0]);
+        return 1;
+    }
+    SetTraceLogLevel(LOG_WARNING);
+
+    int count = argc - 2;
+    PackEntry entries[MAX_ENTRIES];
+    void* data[MAX_ENTRIES];
+    PackHeader header = { .version = PACK_VERSION, .entryCount = (uint32_t)count, .entryOffset = sizeof(PackHeader) };
+    memcpy(header.magic, PACK_MAGIC, 4);
+
+    uint32_t offset = AlignUp(sizeof(PackHeader) + count * sizeof(PackEntry));
+    for (int i = 0; i < count; i++) {
+        if (!LoadEntry(argv[i + 2], &entries[i], &data[i])) {
+            fprintf(stderr, "cannot pack %s\n", argv[i + 2]);
+            return 1;
+        }
+        entries[i].offset = offset;
+        offset = AlignUp(offset + entries[i].size);
+    }
+
+    FILE* out = fopen(argv[1], "wb");
+    if (out == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    static const uint8_t zeros[PACK_ALIGN] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = ok && fwrite(entries, sizeof(PackEntry), count, out) == (size_t)count;
+    uint32_t position = sizeof(PackHeader) + count * sizeof(PackEntry);
+    for (int i = 0; i < count && ok; i++) {
+        ok = fwrite(zeros, 1, entries[i].offset - position, out) == entries[i].offset - position;
+        ok = ok && fwrite(data[i], 1, entries[i].size, out) == entries[i].size;
+        position = entries[i].offset + entries[i].size;
+        if (entries[i].type == PACK_PIXELS) printf("%-24s %5u x %-5u pixels  @%.2f\n", entries[i].name, entries[i].width, entries[i].height, entries[i].scale);
+        else printf("%-24s %8u bytes\n", entries[i].name, entries[i].size);
+        MemFree(data[i]);
+    }
+    if (fclose(out) != 0) ok = false;
+    if (!ok) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("%s: %d entries, %.1f MB\n", argv[1], count, position / 1e6);
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "prof.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define PROF_EVENT_MASK (PROF_EVENTS_PER_THREAD - 1)
+
+typedef struct {
+    const char* name;
+    uint64_t start, end;
+} ProfEvent;
+
+// One recording thread. Only the owner writes `events`; `count` is published
+// with release order so the trace writer sees complete events.
+typedef struct {
+    char name[32];
+    ProfEvent* events;
+    atomic_ulong count; // Events ever recorded, the slot is count & PROF_EVENT_MASK
+    atomic_bool ready;
+} ProfThread;
+
+// Per-frame total of one phase on the frame thread
+typedef struct {
+    const char* name;
+    double frameMs;
+    float history[PROF_HISTORY];
+} ProfZone;
+
+static ProfThread threads[PROF_MAX_THREADS];
+static atomic_int threadCount;
+static _Thread_local ProfThread* currentThread;
+static _Thread_local bool registered;
+static _Thread_local bool isFrameThread;
+
+// Overlay state, touched only by the frame thread
+static ProfZone zones[PROF_MAX_ZONES];
+static int zoneCount;
+static float frameHistory[PROF_HISTORY];
+static int historyCount, historyIndex;
+static uint64_t frameStart;
+
+// Function to read a monotonic clock in nanoseconds
+uint64_t ProfNow(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+    uint64_t rest = counter.QuadPart % frequency.QuadPart;
+    return seconds * 1000000000ull + rest * 1000000000ull / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// Function to give the calling thread its ring; past PROF_MAX_THREADS it records nothing
+static ProfThread* ProfRegister(const char* name) {
+    registered = true;
+    int index = atomic_fetch_add(&threadCount, 1);
+    if (index >= PROF_MAX_THREADS) return NULL;
+
+    ProfThread* thread = &threads[index];
+    thread->events = malloc(PROF_EVENTS_PER_THREAD * sizeof(ProfEvent));
+    if (thread->events == NULL) return NULL;
+    if (name != NULL) snprintf(thread->name, sizeof(thread->name), "%s", name);
+    else snprintf(thread->name, sizeof(thread->name), "thread %d", index);
+    atomic_store_explicit(&thread->ready, true, memory_order_release);
+    currentThread = thread;
+    return thread;
+}
+
+// Function to name the calling thread in traces; call before its first ProfEnd
+void ProfThreadName(const char* name) {
+    if (!registered) ProfRegister(name);
+}
+
+static void ProfRecord(ProfThread* thread, const char* name, uint64_t start, uint64_t end) {
+    unsigned long n = atomic_load_explicit(&thread->count, memory_order_relaxed);
+    thread->events[n & PROF_EVENT_MASK] = (ProfEvent){ name, start, end };
+    atomic_store_explicit(&thread->count, n + 1, memory_order_release);
+}
+
+ProfScope ProfBegin(const char* name) {
+    return (ProfScope){ name, ProfNow() };
+}
+
+void ProfEnd(const ProfScope* scope) {
+    uint64_t end = ProfNow();
+    if (!registered) ProfRegister(NULL);
+    if (currentThread == NULL) return;
+    ProfRecord(currentThread, scope->name, scope->start, end);
+
+    if (!isFrameThread) return;
+    int zone = 0;
+    while (zone < zoneCount && zones[zone].name != scope->name) zone++; // Names are literals, pointers compare
+    if (zone == zoneCount) {
+        if (zoneCount == PROF_MAX_ZONES) return;
+        zones[zoneCount++].name = scope->name;
+    }
+    zones[zone].frameMs += (end - scope->start) / 1e6;
+}
+
+// Function to close the previous frame and start the next; call once per
+// iteration of the main loop, from the thread that runs it
+void ProfFrame(void) {
+    uint64_t now = ProfNow();
+    isFrameThread = true;
+    if (!registered) ProfRegister("main");
+
+    if (frameStart != 0) {
+        if (currentThread != NULL) ProfRecord(currentThread, "frame", frameStart, now);
+        frameHistory[historyIndex] = (now - frameStart) / 1e6f;
+        for (int zone = 0; zone < zoneCount; zone++) {
+            zones[zone].history[historyIndex] = (float)zones[zone].frameMs;
+            zones[zone].frameMs = 0.0;
+        }
+        historyIndex = (historyIndex + 1) % PROF_HISTORY;
+        if (historyCount < PROF_HISTORY) historyCount++;
+    }
+    frameStart = now;
+}
+
+static int CompareFloat(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// Function to format the overlay: frame-time percentiles, then each phase's
+// average and worst ms per frame over the rolling window. Returns the line count.
+int ProfOverlayLines(char lines[][PROF_LINE_LENGTH], int maxLines) {
+    if (maxLines <= 0 || historyCount == 0) return 0;
+
+    float sorted[PROF_HISTORY];
+    memcpy(sorted, frameHistory, historyCount * sizeof(float));
+    qsort(sorted, historyCount, sizeof(float), CompareFloat);
+    float sum = 0.0f;
+    for (int i = 0; i < historyCount; i++) sum += sorted[i];
+    snprintf(lines[0], PROF_LINE_LENGTH, "frame    %6.2f ms avg  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f",
+             sum / historyCount, sorted[historyCount / 2], sorted[historyCount * 95 / 100],
+             sorted[historyCount * 99 / 100], sorted[historyCount - 1]);
+
+    int count = 1;
+    for (int zone = 0; zone < zoneCount && count < maxLines; zone++) {
+        float zoneSum = 0.0f, zoneMax = 0.0f;
+        for (int i = 0; i < historyCount; i++) {
+            zoneSum += zones[zone].history[i];
+            if (zones[zone].history[i] > zoneMax) zoneMax = zones[zone].history[i];
+        }
+        snprintf(lines[count++], PROF_LINE_LENGTH, "%-8s %6.2f ms avg  max %.2f", zones[zone].name, zoneSum / historyCount, zoneMax);
+    }
+    return count;
+}
+
+// Function to write every thread's retained events as Chrome trace-event JSON.
+// Other threads keep recording meanwhile, so a busy thread's oldest few
+// events may be overwritten while they are written out.
+bool ProfWriteTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    int count = atomic_load(&threadCount);
+    if (count > PROF_MAX_THREADS) count = PROF_MAX_THREADS;
+    unsigned long first[PROF_MAX_THREADS], last[PROF_MAX_THREADS];
+    uint64_t epoch = UINT64_MAX;
+    for (int t = 0; t < count; t++) {
+        first[t] = last[t] = 0;
+        if (!atomic_load_explicit(&threads[t].ready, memory_order_acquire)) continue;
+        last[t] = atomic_load_explicit(&threads[t].count, memory_order_acquire);
+        first[t] = last[t] > PROF_EVENTS_PER_THREAD ? last[t] - PROF_EVENTS_PER_THREAD : 0;
+        if (last[t] > first[t] && threads[t].events[first[t] & PROF_EVENT_MASK].start < epoch) {
+            epoch = threads[t].events[first[t] & PROF_EVENT_MASK].start;
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool comma = false;
+    for (int t = 0; t < count; t++) {
+        if (!atomic_load_explicit(&threads[t].ready, memory_order_acquire)) continue;
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                comma ? ",\n" : "", t + 1, threads[t].name);
+        comma = true;
+        for (unsigned long n = first[t]; n < last[t]; n++) {
+            const ProfEvent* event = &threads[t].events[n & PROF_EVENT_MASK];
+            if (event->start < epoch) continue;
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event->name, t + 1, (event->start - epoch) / 1e3, (event->end - event->start) / 1e3);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
@@ -0,0 +1,33 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Phase profiler. Wrap each phase in ProfBegin/ProfEnd with a string literal
+// name; every thread keeps its last PROF_EVENTS_PER_THREAD timings in its own
+// ring, so recording takes no locks. The thread that calls ProfFrame also
+// gets per-phase totals per frame for the on-screen overlay. ProfWriteTrace
+// dumps all rings as Chrome trace-event JSON (chrome://tracing, Perfetto).
+
+#define PROF_MAX_THREADS 8
+#define PROF_EVENTS_PER_THREAD 65536 // Power of two
+#define PROF_MAX_ZONES 32            // Distinct phase names tracked by the overlay
+#define PROF_HISTORY 240             // Frames in the overlay's rolling window
+#define PROF_LINE_LENGTH 96
+
+typedef struct {
+    const char* name;
+    uint64_t start;
+} ProfScope;
+
+uint64_t ProfNow(void);
+void ProfThreadName(const char* name);
+ProfScope ProfBegin(const char* name);
+void ProfEnd(const ProfScope* scope);
+void ProfFrame(void);
+int ProfOverlayLines(char lines[][PROF_LINE_LENGTH], int maxLines);
+bool ProfWriteTrace(const char* path);
+
+#endif
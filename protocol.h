@@ -0,0 +1,179 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Wire protocol shared by server.c and client.c.
+//
+// Every message is a fixed-size little-endian struct that starts with a
+// MsgHeader carrying the total message length, so a receiver can cut a TCP
+// byte stream back into messages no matter how reads split or coalesce them.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "protocol.h maps wire structs directly and needs a little-endian host"
+#endif
+
+#define PROTO_VERSION 2
+
+typedef enum {
+    MSG_ID = 1,  // server -> client: your player id
+    MSG_FULL,    // server -> client: no free player slot
+    MSG_READY,   // client -> server
+    MSG_START,   // server -> clients: the match's chart seed
+    // 5 and 6 were UPDATE and STATE, retired for MSG_SNAPSHOT; 11 was SPAWN,
+    // retired as charts come from the START seed. The numbers stay unused.
+    MSG_PING = 7, // client -> server: echoed straight back as MSG_PONG
+    MSG_PONG,
+    MSG_SNAPSHOT, // server -> clients: every player in the room, sent at the server tick rate
+    MSG_INPUT,    // client -> server: a key press stamped with the client's match tick
+    MSG_JUDGMENT = 12 // server -> clients: how the server judged a press
+} MsgType;
+
+#define PROTO_ROOM_PLAYERS 2
+#define PROTO_MAX_INPUT_LAG_MS 250 // Presses reaching the server later than this are judged as if this late
+#define PROTO_REJECTED 255 // MsgJudgment.result for a press the server dropped unjudged, sent to its player only
+
+#pragma pack(push, 1)
+
+typedef struct {
+    uint16_t length; // Whole message including this header
+    uint8_t version;
+    uint8_t type;
+} MsgHeader;
+
+typedef struct {
+    MsgHeader header;
+    int32_t id;
+} MsgId;
+
+typedef struct {
+    MsgHeader header;
+    uint32_t seed; // Both clients run SimInit with it and spawn the same chart locally
+} MsgStart;
+
+typedef struct {
+    MsgHeader header;
+    uint64_t timestamp; // Opaque to the server, the sender's clock
+} MsgPing;
+
+typedef struct {
+    float health;
+    int32_t score;
+} PlayerState;
+
+typedef struct {
+    MsgHeader header;
+    uint32_t tick; // Match tick the room has run to; every press up to it is judged and its MSG_JUDGMENT sent first
+    PlayerState players[PROTO_ROOM_PLAYERS]; // Indexed by player id - 1
+} MsgSnapshot;
+
+// Ticks count SIM_TICK_RATE steps from the moment the client saw MSG_START
+typedef struct {
+    MsgHeader header;
+    uint32_t tick;
+    uint8_t lane;
+} MsgInput;
+
+typedef struct {
+    MsgHeader header;
+    uint32_t tick;  // When the press happened
+    uint8_t player; // Player id of whoever pressed
+    uint8_t lane;
+    uint8_t result; // A Judgment from sim.h, or PROTO_REJECTED
+} MsgJudgment;
+
+#pragma pack(pop)
+
+// Any decoded message; look at header.type to pick the member
+typedef union {
+    MsgHeader header;
+    MsgId id;
+    MsgStart start;
+    MsgPing ping;
+    MsgSnapshot snapshot;
+    MsgInput input;
+    MsgJudgment judgment;
+} Message;
+
+// Function to get the wire size of a message type, 0 if unknown
+static inline size_t ProtoMessageSize(uint8_t type) {
+    switch (type) {
+        case MSG_ID: return sizeof(MsgId);
+        case MSG_FULL:
+        case MSG_READY: return sizeof(MsgHeader);
+        case MSG_START: return sizeof(MsgStart);
+        case MSG_PING:
+        case MSG_PONG: return sizeof(MsgPing);
+        case MSG_SNAPSHOT: return sizeof(MsgSnapshot);
+        case MSG_INPUT: return sizeof(MsgInput);
+        case MSG_JUDGMENT: return sizeof(MsgJudgment);
+    }
+    return 0;
+}
+
+// Function to fill in a header; callers set the body and send ProtoMessageSize(type) bytes
+static inline void ProtoInit(Message* msg, MsgType type) {
+    msg->header.length = (uint16_t)ProtoMessageSize(type);
+    msg->header.version = PROTO_VERSION;
+    msg->header.type = (uint8_t)type;
+}
+
+#ifndef PROTO_DECODER_SIZE
+#define PROTO_DECODER_SIZE 4096
+#endif
+
+// Streaming decoder: receive straight into ProtoDecoderSpace(), report the
+// byte count with ProtoDecoderCommit(), then pull messages until it returns 0
+typedef struct {
+    uint8_t buf[PROTO_DECODER_SIZE];
+    size_t start; // First byte not yet decoded
+    size_t end;   // One past the last received byte
+} ProtoDecoder;
+
+static inline void ProtoDecoderReset(ProtoDecoder* dec) {
+    dec->start = 0;
+    dec->end = 0;
+}
+
+// Function to get where the next recv should write, compacting leftovers first
+static inline uint8_t* ProtoDecoderSpace(ProtoDecoder* dec, size_t* space) {
+    if (dec->start > 0) {
+        memmove(dec->buf, dec->buf + dec->start, dec->end - dec->start);
+        dec->end -= dec->start;
+        dec->start = 0;
+    }
+    *space = PROTO_DECODER_SIZE - dec->end;
+    return dec->buf + dec->end;
+}
+
+static inline void ProtoDecoderCommit(ProtoDecoder* dec, size_t received) {
+    dec->end += received;
+}
+
+// Function to pull the next complete message: 1 when one was copied to msg,
+// 0 when more bytes are needed, -1 when the stream is not speaking this protocol
+static inline int ProtoDecoderNext(ProtoDecoder* dec, Message* msg) {
+    while (dec->end - dec->start >= sizeof(MsgHeader)) {
+        MsgHeader header;
+        memcpy(&header, dec->buf + dec->start, sizeof(header));
+        if (header.version != PROTO_VERSION) return -1;
+        if (header.length < sizeof(MsgHeader) || header.length > PROTO_DECODER_SIZE) return -1;
+        if (dec->end - dec->start < header.length) return 0;
+
+        size_t expected = ProtoMessageSize(header.type);
+        if (expected == 0 || header.length != expected) {
+            // Unknown or resized message from a newer peer: the length says how far to skip
+            dec->start += header.length;
+            continue;
+        }
+
+        memcpy(msg, dec->buf + dec->start, header.length);
+        dec->start += header.length;
+        return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include "replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_INITIAL_CAPACITY 256
+
+static uint32_t ChartNoteTotal(const Chart* chart) {
+    uint32_t total = 0;
+    for (int lane = 0; lane < CHART_LANES; lane++) total += chart->header->noteCount[lane];
+    return total;
+}
+
+// Function to start recording a match; `chart` is NULL for generated arrows
+void ReplayBegin(Replay* replay, uint32_t seed, const Chart* chart) {
+    uint32_t capacity = replay->capacity;
+    ReplayPress* presses = replay->presses; // Kept across matches, recording reuses it
+    memset(replay, 0, sizeof(*replay));
+    replay->presses = presses;
+    replay->capacity = capacity;
+
+    memcpy(replay->header.magic, REPLAY_MAGIC, 4);
+    replay->header.version = REPLAY_VERSION;
+    replay->header.tickRate = SIM_TICK_RATE;
+    replay->header.seed = seed;
+    if (chart != NULL) {
+        replay->header.flags |= REPLAY_CHART;
+        replay->header.chartLengthUs = chart->header->lengthUs;
+        replay->header.chartNotes = ChartNoteTotal(chart);
+    }
+}
+
+// Function to append one judged press; `time` is seconds since the match started
+void ReplayRecord(Replay* replay, uint32_t tick, double time, int player, int lane, Judgment result) {
+    if (replay->header.pressCount == replay->capacity) {
+        uint32_t capacity = replay->capacity ? replay->capacity * 2 : REPLAY_INITIAL_CAPACITY;
+        ReplayPress* presses = realloc(replay->presses, capacity * sizeof(ReplayPress));
+        if (presses == NULL) return; // Out of memory: the replay will fail verification, the match goes on
+        replay->presses = presses;
+        replay->capacity = capacity;
+    }
+
+    ReplayPress* press = &replay->presses[replay->header.pressCount++];
+    press->tick = tick;
+    press->timeUs = time > 0.0 ? (uint32_t)(time * 1e6) : 0;
+    press->player = (uint8_t)player;
+    press->lane = (uint8_t)lane;
+    press->result = (uint8_t)result;
+    press->reserved = 0;
+}
+
+// Function to store the outcome the replay has to reproduce
+void ReplayEnd(Replay* replay, const SimState* state) {
+    replay->header.finalTick = (uint32_t)state->tick;
+    for (int p = 0; p < 2; p++) {
+        replay->header.score[p] = state->players[p].score;
+        replay->header.health[p] = state->players[p].health;
+    }
+}
+
+bool ReplaySave(const Replay* replay, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) return false;
+    uint32_t count = replay->header.pressCount;
+    bool ok = fwrite(&replay->header, sizeof(ReplayHeader), 1, file) == 1;
+    ok = ok && fwrite(replay->presses, sizeof(ReplayPress), count, file) == count;
+    if (fclose(file) != 0) ok = false;
+    return ok;
+}
+
+// Function to read a replay file, rejecting other formats and other tick rates
+bool ReplayLoad(Replay* replay, const char* path) {
+    memset(replay, 0, sizeof(*replay));
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    ReplayHeader* header = &replay->header;
+    bool ok = fread(header, sizeof(ReplayHeader), 1, file) == 1 &&
+              memcmp(header->magic, REPLAY_MAGIC, 4) == 0 &&
+              header->version == REPLAY_VERSION &&
+              header->tickRate == SIM_TICK_RATE;
+    if (ok) {
+        replay->capacity = header->pressCount;
+        replay->presses = malloc((header->pressCount + 1) * sizeof(ReplayPress));
+        ok = replay->presses != NULL &&
+             fread(replay->presses, sizeof(ReplayPress), header->pressCount, file) == header->pressCount;
+    }
+    fclose(file);
+
+    if (!ok) ReplayFree(replay);
+    return ok;
+}
+
+// Function to check that `chart` (NULL for generated arrows) is what the match played
+bool ReplayMatchesChart(const Replay* replay, const Chart* chart) {
+    if (!(replay->header.flags & REPLAY_CHART)) return chart == NULL;
+    return chart != NULL &&
+           chart->header->lengthUs == replay->header.chartLengthUs &&
+           ChartNoteTotal(chart) == replay->header.chartNotes;
+}
+
+// Function to re-simulate a replay into `state`. Presses are judged the way
+// the server judges them, right after the step they were stamped with, so
+// local and networked recordings replay the same way. Returns the number of
+// presses whose judgment differs from the recording.
+int ReplayRun(const Replay* replay, const Chart* chart, SimState* state) {
+    const ReplayHeader* header = &replay->header;
+    SimInit(state, header->seed);
+    if (chart != NULL) SimUseChart(state, chart);
+
+    int mismatches = 0;
+    uint32_t next = 0;
+    while (!state->over && (next < header->pressCount || (uint32_t)state->tick < header->finalTick)) {
+        // Straight to the step the next press follows, or to the end
+        uint32_t until = next < header->pressCount ? replay->presses[next].tick : header->finalTick;
+        if (until <= (uint32_t)state->tick) until = (uint32_t)state->tick + 1;
+        SimAdvance(state, (int)until);
+
+        while (next < header->pressCount && replay->presses[next].tick <= (uint32_t)state->tick) {
+            const ReplayPress* press = &replay->presses[next++];
+            if (press->player > 1 || press->lane >= SIM_LANES) {
+                mismatches++;
+                continue;
+            }
+            Player* attacker = &state->players[press->player];
+            Player* defender = &state->players[1 - press->player];
+            if (JudgePress(attacker, defender, press->lane, press->tick * SIM_DT) != (Judgment)press->result) mismatches++;
+        }
+    }
+
+    // Presses recorded after the match ended here were never judged
+    return mismatches + (int)(header->pressCount - next);
+}
+
+void ReplayFree(Replay* replay) {
+    free(replay->presses);
+    memset(replay, 0, sizeof(*replay));
+}
@@ -0,0 +1,55 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sim.h"
+
+// Match replay: the seed, the chart the match used and every judged press.
+// The simulation is deterministic, so re-running it with the same presses
+// must reproduce each judgment and the final score and health. The file is
+// the header followed by ReplayPress[pressCount], little-endian like charts.
+
+#define REPLAY_MAGIC "DRPL"
+#define REPLAY_VERSION 1
+#define REPLAY_CHART 1 // Flag: the match played a chart instead of generated arrows
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t tickRate;       // SIM_TICK_RATE of the recording build
+    uint32_t seed;
+    uint32_t flags;
+    uint32_t chartLengthUs;  // Identify the chart, when REPLAY_CHART is set
+    uint32_t chartNotes;
+    uint32_t finalTick;
+    uint32_t pressCount;
+    int32_t score[2];
+    float health[2];
+} ReplayHeader;
+
+typedef struct {
+    uint32_t tick;   // Simulation step the press was judged on
+    uint32_t timeUs; // Match-clock time the press was made
+    uint8_t player;  // 0: left, 1: right
+    uint8_t lane;
+    uint8_t result;  // Judgment
+    uint8_t reserved;
+} ReplayPress;
+
+typedef struct {
+    ReplayHeader header;
+    ReplayPress* presses;
+    uint32_t capacity;
+} Replay;
+
+void ReplayBegin(Replay* replay, uint32_t seed, const Chart* chart);
+void ReplayRecord(Replay* replay, uint32_t tick, double time, int player, int lane, Judgment result);
+void ReplayEnd(Replay* replay, const SimState* state);
+bool ReplaySave(const Replay* replay, const char* path);
+bool ReplayLoad(Replay* replay, const char* path);
+bool ReplayMatchesChart(const Replay* replay, const Chart* chart);
+int ReplayRun(const Replay* replay, const Chart* chart, SimState* state);
+void ReplayFree(Replay* replay);
+
+#endif
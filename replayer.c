@@ -0,0 +1,99 @@
+#include "replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+// Headless replayer: re-simulates recorded matches as fast as the simulation
+// runs and checks every judgment and the final score and health against the
+// recording. Exits nonzero if any replay fails, so a directory of replays
+// works as a regression corpus.
+
+static double NowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to compare a finished re-simulation with the recorded outcome
+static bool OutcomeMatches(const ReplayHeader* header, const SimState* sim) {
+    for (int p = 0; p < 2; p++) {
+        if (sim->players[p].score != header->score[p] || sim->players[p].health != header->health[p]) return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* chartPath = NULL;
+    int repeat = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:")) != -1) {
+        switch (opt) {
+            case 'c': chartPath = optarg; break;
+            case 'n': repeat = atoi(optarg); break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind >= argc || repeat <= 0) {
+        fprintf(stderr, "usage: %s [-c chart] [-n repeat] file.replay...\n", argv[0]);
+        return 1;
+    }
+
+    Chart chart;
+    bool hasChart = chartPath != NULL;
+    if (hasChart && !ChartOpen(&chart, chartPath)) {
+        fprintf(stderr, "cannot open chart %s\n", chartPath);
+        return 1;
+    }
+
+    int failed = 0;
+    long long totalSteps = 0;
+    double totalSimulated = 0.0, totalElapsed = 0.0;
+    SimState sim;
+
+    for (int i = optind; i < argc; i++) {
+        Replay replay;
+        if (!ReplayLoad(&replay, argv[i])) {
+            printf("%s: not a replay for this build\n", argv[i]);
+            failed++;
+            continue;
+        }
+        const Chart* matchChart = replay.header.flags & REPLAY_CHART ? (hasChart ? &chart : NULL) : NULL;
+        if (!ReplayMatchesChart(&replay, matchChart)) {
+            printf("%s: %s\n", argv[i], replay.header.flags & REPLAY_CHART ? "needs the chart it was recorded with (-c)" : "recorded without a chart");
+            ReplayFree(&replay);
+            failed++;
+            continue;
+        }
+
+        int mismatches = 0;
+        double start = NowSeconds();
+        for (int r = 0; r < repeat; r++) mismatches = ReplayRun(&replay, matchChart, &sim);
+        double elapsed = NowSeconds() - start;
+
+        bool ok = mismatches == 0 && OutcomeMatches(&replay.header, &sim);
+        printf("%s: %s, seed %u, %u presses, %.1f s, score %d-%d, health %.1f-%.1f, %.0fx real time\n",
+               argv[i], ok ? "ok" : "MISMATCH", replay.header.seed, replay.header.pressCount, sim.time,
+               sim.players[0].score, sim.players[1].score, sim.players[0].health, sim.players[1].health,
+               sim.time * repeat / elapsed);
+        if (!ok) {
+            printf("  recorded score %d-%d, health %.1f-%.1f, %d judgment(s) differ\n",
+                   replay.header.score[0], replay.header.score[1], replay.header.health[0], replay.header.health[1], mismatches);
+            failed++;
+        }
+
+        totalSteps += (long long)sim.tick * repeat;
+        totalSimulated += sim.time * repeat;
+        totalElapsed += elapsed;
+        ReplayFree(&replay);
+    }
+
+    int count = argc - optind;
+    printf("%d/%d replays ok, %.0f steps/sec, %.0fx real time\n", count - failed, count,
+           totalElapsed > 0.0 ? totalSteps / totalElapsed : 0.0, totalElapsed > 0.0 ? totalSimulated / totalElapsed : 0.0);
+
+    if (hasChart) ChartClose(&chart);
+    return failed > 0 ? 1 : 0;
+}
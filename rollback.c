@@ -0,0 +1,348 @@
+#include "rollback.h"
+#include "protocol.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// A press can reach the server this long after its tick and still be judged
+// at it, so a snapshot only settles the ticks older than that. A predicted
+// hit or one of our own presses still unconfirmed this far back is taken back.
+#define SETTLE_TICKS (PROTO_MAX_INPUT_LAG_MS * SIM_TICK_RATE / 1000)
+
+// How far from its hit time a press still takes an arrow, rounded up
+#define HIT_WINDOW_TICKS ((int)(GOOD_THRESHOLD / ARROW_SPEED * SIM_TICK_RATE) + 1)
+
+static uint64_t MonotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static SimState* SaveSlot(Rollback* rollback, int tick) {
+    return &rollback->states[(tick / ROLLBACK_SAVE_INTERVAL) % ROLLBACK_STATES];
+}
+
+// Function to find the save a redo of `tick`'s step starts from: the last one
+// before that step, or NULL once it has left the window
+static const SimState* FindSave(Rollback* rollback, const SimState* sim, int tick) {
+    int saveTick = (tick - 1) / ROLLBACK_SAVE_INTERVAL * ROLLBACK_SAVE_INTERVAL;
+    if (saveTick < rollback->historyStart || saveTick > sim->tick) return NULL;
+    const SimState* save = SaveSlot(rollback, saveTick);
+    return save->tick == saveTick ? save : NULL;
+}
+
+// Function to tell whether a change at `tick` can still be redone; future ticks need no redo
+static bool Rewindable(Rollback* rollback, const SimState* sim, int tick) {
+    return tick > sim->tick || FindSave(rollback, sim, tick) != NULL;
+}
+
+static void MarkRewind(Rollback* rollback, int tick) {
+    if (tick < rollback->rewindTick) rollback->rewindTick = tick;
+}
+
+// Function to add a press in tick order; when full, the oldest goes
+static void InsertPress(Rollback* rollback, RollbackPress press) {
+    if (rollback->pressCount == ROLLBACK_MAX_PRESSES) {
+        memmove(rollback->presses, rollback->presses + 1, (ROLLBACK_MAX_PRESSES - 1) * sizeof(RollbackPress));
+        rollback->pressCount--;
+    }
+    int i = rollback->pressCount++;
+    while (i > 0 && rollback->presses[i - 1].tick > press.tick) {
+        rollback->presses[i] = rollback->presses[i - 1];
+        i--;
+    }
+    rollback->presses[i] = press;
+}
+
+static void RemovePress(Rollback* rollback, int index) {
+    memmove(rollback->presses + index, rollback->presses + index + 1, (rollback->pressCount - index - 1) * sizeof(RollbackPress));
+    rollback->pressCount--;
+}
+
+// Function to take back one of our own presses the server will not judge as
+// it was applied, redoing from its tick if that can still be undone
+static void TakeBack(Rollback* rollback, const SimState* sim, int index) {
+    int tick = rollback->presses[index].tick;
+    if (Rewindable(rollback, sim, tick)) MarkRewind(rollback, tick);
+    else rollback->stats.late++;
+    RemovePress(rollback, index);
+}
+
+// Function to judge a press the window no longer reaches straight into the
+// present state, as the server judges late presses. Saves from before now
+// lack it, so they are no longer rewound to.
+static void JudgeLate(Rollback* rollback, SimState* sim, RollbackPress press) {
+    sim->judged[press.player] = JudgePress(&sim->players[press.player], &sim->players[1 - press.player], press.lane, press.tick * SIM_DT);
+    rollback->historyStart = sim->tick + 1;
+    rollback->stats.late++;
+}
+
+// Function to add a press, redoing from its tick when that is in the past
+static void AddPress(Rollback* rollback, SimState* sim, RollbackPress press) {
+    if (Rewindable(rollback, sim, press.tick)) MarkRewind(rollback, press.tick);
+    else JudgeLate(rollback, sim, press);
+    InsertPress(rollback, press);
+}
+
+// Function to allocate the saved-state window
+bool RollbackInit(Rollback* rollback) {
+    memset(rollback, 0, sizeof(*rollback));
+    rollback->states = malloc(ROLLBACK_STATES * sizeof(SimState));
+    if (rollback->states == NULL) return false;
+    RollbackReset(rollback, 1);
+    return true;
+}
+
+// Function to forget the last match; call with SimInit. `predictedPlayer` is
+// the opponent's index in SimState.players.
+void RollbackReset(Rollback* rollback, int predictedPlayer) {
+    SimState* states = rollback->states;
+    RollbackStats stats = rollback->stats; // The overlay keeps counting across matches
+    memset(rollback, 0, sizeof(*rollback));
+    rollback->states = states;
+    rollback->stats = stats;
+    for (int i = 0; i < ROLLBACK_STATES; i++) states[i].tick = -1;
+    rollback->rewindTick = INT_MAX;
+    rollback->predictedPlayer = predictedPlayer;
+}
+
+// Function to apply one of our own presses right away. It stays unconfirmed
+// until the server's judgment of it comes back.
+void RollbackLocalPress(Rollback* rollback, const SimState* sim, int player, int tick, int lane) {
+    RollbackPress press = { .tick = tick > 1 ? tick : 1, .player = (uint8_t)player, .lane = (uint8_t)lane };
+    if (Rewindable(rollback, sim, press.tick)) MarkRewind(rollback, press.tick);
+    InsertPress(rollback, press); // Out of the window: the next Advance's steps are already past it
+}
+
+// Function to take the server's judgment of a press. Our own press is
+// confirmed, moved if the server clamped its tick; the opponent's is new.
+// Either way the match is redone from the earliest tick that changed. For
+// the opponent that is the start of the press's hit window: a prediction
+// there took the arrow the press was for, and the redo leaves it to the press.
+void RollbackJudged(Rollback* rollback, SimState* sim, int player, int tick, int lane, Judgment result) {
+    RollbackPress press = { .tick = tick > 1 ? tick : 1, .player = (uint8_t)player, .lane = (uint8_t)lane, .confirmed = true, .snapshots = rollback->snapshots };
+    if (player == rollback->predictedPlayer) {
+        rollback->predictHits = result != JUDGE_MISS;
+        int windowStart = press.tick - HIT_WINDOW_TICKS > 1 ? press.tick - HIT_WINDOW_TICKS : 1;
+        if (rollback->predictedCount > 0 && Rewindable(rollback, sim, windowStart)) MarkRewind(rollback, windowStart);
+    }
+
+    for (int i = 0; i < rollback->pressCount; i++) {
+        RollbackPress* own = &rollback->presses[i];
+        if (own->confirmed || own->player != player || own->lane != lane) continue;
+        if (own->tick == press.tick) {
+            own->confirmed = true;
+            own->snapshots = rollback->snapshots;
+            return;
+        }
+
+        // Clamped by the server: take the prediction back, if it can still be undone
+        TakeBack(rollback, sim, i);
+        break;
+    }
+    AddPress(rollback, sim, press);
+}
+
+// Function to take back one of our own presses the server rejected unjudged
+void RollbackRejected(Rollback* rollback, const SimState* sim, int player, int tick, int lane) {
+    if (tick < 1) tick = 1;
+    for (int i = 0; i < rollback->pressCount; i++) {
+        const RollbackPress* own = &rollback->presses[i];
+        if (own->confirmed || own->player != player || own->lane != lane || own->tick != tick) continue;
+        TakeBack(rollback, sim, i);
+        return;
+    }
+}
+
+// Function to tell whether the presses up to `tick` differ from what the
+// server had judged at snapshot number `snapshot`: one of ours still awaits
+// the server, or a judgment came in after that snapshot
+static bool Unsettled(const Rollback* rollback, int tick, int snapshot) {
+    for (int i = 0; i < rollback->pressCount && rollback->presses[i].tick <= tick; i++) {
+        if (!rollback->presses[i].confirmed || rollback->presses[i].snapshots >= snapshot) return true;
+    }
+    return false;
+}
+
+// Function to take a snapshot. It shows the server's health and score once
+// every press it had by then was judged, so the state at its tick can be
+// checked; predictions and our own presses older than SETTLE_TICKS before
+// it are settled.
+void RollbackSnapshot(Rollback* rollback, SimState* sim, int tick, const float health[2], const int score[2]) {
+    rollback->snapshots++;
+    if (tick - SETTLE_TICKS > rollback->confirmedTick) rollback->confirmedTick = tick - SETTLE_TICKS;
+
+    // Our own presses the server would have judged by now, had it kept them,
+    // were dropped: take them back as for a clamped press. A judgment that
+    // still turns up is then added like the opponent's.
+    for (int i = 0; i < rollback->pressCount && rollback->presses[i].tick <= rollback->confirmedTick;) {
+        if (rollback->presses[i].confirmed) i++;
+        else TakeBack(rollback, sim, i);
+    }
+
+    // Ended here on confirmed presses alone, with no redo pending, but not
+    // on the server: a desync no rewind will fix and no check would reach.
+    // Take the server's state.
+    bool serverOver = health[0] <= 0 || health[1] <= 0;
+    if (sim->over && !serverOver && tick >= sim->tick && rollback->rewindTick > sim->tick && rollback->predictedCount == 0 &&
+        !Unsettled(rollback, sim->tick, rollback->snapshots)) {
+        for (int p = 0; p < 2; p++) {
+            sim->players[p].health = health[p];
+            sim->players[p].score = score[p];
+        }
+        sim->over = false;
+        rollback->historyStart = sim->tick + 1;
+        rollback->stats.desyncs++;
+        return;
+    }
+    if (!Rewindable(rollback, sim, tick)) return;
+
+    rollback->checkPending = true;
+    rollback->checkTick = tick;
+    rollback->checkSnapshot = rollback->snapshots;
+    for (int p = 0; p < 2; p++) {
+        rollback->checkHealth[p] = health[p];
+        rollback->checkScore[p] = score[p];
+    }
+    MarkRewind(rollback, tick);
+}
+
+// Function to note a prediction made at `tick`. The ticks only serve to find
+// where to rewind once a prediction settles, and a redo from there makes every
+// later one again. So with the array full, the new one is folded into the
+// newest entry, which is no later: the rewind that settles that entry redoes
+// this one too, and records it then if it still stands.
+static void RecordPrediction(Rollback* rollback, int tick) {
+    if (rollback->predictedCount == ROLLBACK_MAX_PREDICTIONS) {
+        rollback->stats.folded++;
+        return;
+    }
+    rollback->predictedTicks[rollback->predictedCount++] = tick;
+}
+
+// Function to tell whether the opponent has a judged press coming in `lane`
+// within a hit window after this tick, which takes the arrow instead
+static bool PressDue(const Rollback* rollback, const SimState* sim, int lane) {
+    for (int i = rollback->pressCount - 1; i >= 0 && rollback->presses[i].tick > sim->tick; i--) {
+        const RollbackPress* press = &rollback->presses[i];
+        if (press->player == rollback->predictedPlayer && press->lane == lane && press->tick <= sim->tick + HIT_WINDOW_TICKS) return true;
+    }
+    return false;
+}
+
+// Function to predict the opponent hitting every arrow that reaches the line
+// this tick, unless a press they really made is about to
+static void PredictHits(Rollback* rollback, SimState* sim) {
+    int p = rollback->predictedPlayer;
+    for (int lane = 0; lane < SIM_LANES; lane++) {
+        ArrowRing* ring = &sim->players[p].lanes[lane];
+        int target = FindJudgeTarget(ring, sim->time);
+        if (target == -1 || ArrowRingAt(ring, target)->hitTime > sim->time) continue;
+        if (PressDue(rollback, sim, lane)) continue;
+
+        sim->judged[p] = JudgePress(&sim->players[p], &sim->players[1 - p], lane, sim->time);
+        RecordPrediction(rollback, sim->tick);
+    }
+}
+
+// Function to compare the state at the snapshot's tick with the server's,
+// when both were built from the same presses and no predictions. Only
+// predictions up to that tick are in its state; later ones do not hold a
+// check back.
+static void CheckSnapshot(Rollback* rollback, SimState* sim) {
+    rollback->checkPending = false;
+    if (rollback->predictedCount > 0 && rollback->predictedTicks[0] <= sim->tick) return;
+    if (Unsettled(rollback, sim->tick, rollback->checkSnapshot)) return;
+
+    bool match = true;
+    for (int p = 0; p < 2; p++) {
+        if (fabsf(sim->players[p].health - rollback->checkHealth[p]) > 0.01f || sim->players[p].score != rollback->checkScore[p]) match = false;
+    }
+    if (match) return;
+
+    // Take the server's word for it; earlier saves still hold our version
+    for (int p = 0; p < 2; p++) {
+        sim->players[p].health = rollback->checkHealth[p];
+        sim->players[p].score = rollback->checkScore[p];
+    }
+    rollback->historyStart = sim->tick;
+    rollback->stats.desyncs++;
+}
+
+// Function to run the match to `targetTick`, first rewinding and redoing
+// whatever changed since the last call. Steps as the server does: SimStep,
+// then the presses due at that tick, the left player's first.
+void RollbackAdvance(Rollback* rollback, SimState* sim, int targetTick) {
+    uint64_t startNs = 0;
+    rollback->stats.lastTicks = 0;
+    rollback->stats.lastMs = 0.0;
+
+    // Predictions the server has settled, or never confirmed in time, are redone
+    int predictFrom = targetTick - SETTLE_TICKS;
+    if (rollback->confirmedTick > predictFrom) predictFrom = rollback->confirmedTick;
+    if (rollback->predictedCount > 0 && rollback->predictedTicks[0] <= predictFrom) MarkRewind(rollback, rollback->predictedTicks[0]);
+
+    if (rollback->rewindTick <= sim->tick) {
+        const SimState* save = FindSave(rollback, sim, rollback->rewindTick);
+        if (save != NULL) {
+            startNs = MonotonicNs();
+            rollback->stats.lastTicks = sim->tick - save->tick;
+            rollback->stats.rewinds++;
+            *sim = *save;
+        }
+    }
+    rollback->rewindTick = INT_MAX;
+
+    // Predictions after the save are made again, or not; older ones are settled
+    int kept = 0;
+    for (int i = 0; i < rollback->predictedCount; i++) {
+        int tick = rollback->predictedTicks[i];
+        if (tick <= sim->tick && tick > predictFrom) rollback->predictedTicks[kept++] = tick;
+    }
+    rollback->predictedCount = kept;
+
+    int cursor = 0;
+    while (cursor < rollback->pressCount && rollback->presses[cursor].tick <= sim->tick) cursor++;
+    SimState* slot = SaveSlot(rollback, sim->tick);
+    if (sim->tick % ROLLBACK_SAVE_INTERVAL == 0 && slot->tick != sim->tick) *slot = *sim;
+
+    while (sim->tick < targetTick && !sim->over) {
+        SimStep(sim, NULL);
+
+        int end = cursor;
+        while (end < rollback->pressCount && rollback->presses[end].tick <= sim->tick) end++;
+        for (int p = 0; p < 2; p++) {
+            for (int i = cursor; i < end; i++) {
+                const RollbackPress* press = &rollback->presses[i];
+                if (press->player != p) continue;
+                sim->judged[p] = JudgePress(&sim->players[p], &sim->players[1 - p], press->lane, press->tick * SIM_DT);
+            }
+        }
+        cursor = end;
+
+        if (rollback->predictHits && sim->tick > predictFrom) PredictHits(rollback, sim);
+        if (rollback->checkPending && sim->tick == rollback->checkTick) CheckSnapshot(rollback, sim);
+        if (sim->tick % ROLLBACK_SAVE_INTERVAL == 0) *SaveSlot(rollback, sim->tick) = *sim;
+    }
+
+    if (startNs != 0) {
+        rollback->stats.lastMs = (MonotonicNs() - startNs) / 1e6;
+        if (rollback->stats.lastMs > rollback->stats.maxMs) rollback->stats.maxMs = rollback->stats.lastMs;
+        if (rollback->stats.lastTicks > rollback->stats.maxTicks) rollback->stats.maxTicks = rollback->stats.lastTicks;
+    }
+
+    // Confirmed presses older than the window can never be redone
+    kept = 0;
+    for (int i = 0; i < rollback->pressCount; i++) {
+        const RollbackPress* press = &rollback->presses[i];
+        if (!press->confirmed || press->tick > sim->tick - ROLLBACK_WINDOW) rollback->presses[kept++] = *press;
+    }
+    rollback->pressCount = kept;
+}
+
+void RollbackFree(Rollback* rollback) {
+    free(rollback->states);
+    rollback->states = NULL;
+}
@@ -0,0 +1,76 @@
+#ifndef ROLLBACK_H
+#define ROLLBACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sim.h"
+
+// Rollback for the networked client. The client runs the match itself from
+// the START seed: its own presses apply at once, the opponent's are predicted,
+// and the state is saved every ROLLBACK_SAVE_INTERVAL ticks. When the server's
+// judgment of a press arrives, the match rewinds to the last state saved
+// before the press and re-simulates to the present with what is now known.
+// A rewind never goes further back than the saved window, which bounds the
+// re-simulation a frame can cost.
+
+#define ROLLBACK_SAVE_INTERVAL 16 // Ticks between saved states
+#define ROLLBACK_STATES 64        // Saved states kept, about a second at 1000 Hz
+#define ROLLBACK_WINDOW (ROLLBACK_SAVE_INTERVAL * ROLLBACK_STATES)
+#define ROLLBACK_MAX_PRESSES 256  // Presses kept for re-simulation, oldest dropped first
+#define ROLLBACK_MAX_PREDICTIONS 64
+
+typedef struct {
+    int tick;
+    uint8_t player;  // 0 or 1, as SimState.players
+    uint8_t lane;
+    bool confirmed;  // Judged by the server; unconfirmed presses are our own
+    int snapshots;   // Snapshots received before it was confirmed
+} RollbackPress;
+
+typedef struct {
+    long rewinds;
+    long late;          // Presses older than the window, judged on the spot instead
+    long desyncs;       // Snapshots the re-simulated state disagreed with
+    long folded;        // Predictions past ROLLBACK_MAX_PREDICTIONS, tracked by an older one
+    int lastTicks;      // Ticks re-simulated by the last Advance
+    int maxTicks;
+    double lastMs;
+    double maxMs;
+} RollbackStats;
+
+typedef struct {
+    SimState* states;    // Slot (tick / ROLLBACK_SAVE_INTERVAL) % ROLLBACK_STATES; SimState.tick says which save it holds
+    int historyStart;    // No rewinding to a save older than this
+    RollbackPress presses[ROLLBACK_MAX_PRESSES]; // Sorted by tick
+    int pressCount;
+    int rewindTick;      // Earliest tick whose step has to be redone, INT_MAX for none
+
+    // Prediction: the opponent is expected to hit each arrow on time while
+    // their last judged press hit, and to press nothing otherwise
+    int predictedPlayer;
+    bool predictHits;
+    int confirmedTick;   // The server has judged every press up to this tick
+    int snapshots;       // Snapshots received this match
+    int predictedTicks[ROLLBACK_MAX_PREDICTIONS]; // Ticks predictions were applied at, ascending
+    int predictedCount;
+
+    // Last snapshot, checked once the state reaches its tick
+    bool checkPending;
+    int checkTick;
+    int checkSnapshot;   // Its number; presses confirmed after it were judged after its tick
+    float checkHealth[2];
+    int checkScore[2];
+
+    RollbackStats stats;
+} Rollback;
+
+bool RollbackInit(Rollback* rollback);
+void RollbackReset(Rollback* rollback, int predictedPlayer);
+void RollbackLocalPress(Rollback* rollback, const SimState* sim, int player, int tick, int lane);
+void RollbackJudged(Rollback* rollback, SimState* sim, int player, int tick, int lane, Judgment result);
+void RollbackRejected(Rollback* rollback, const SimState* sim, int player, int tick, int lane);
+void RollbackSnapshot(Rollback* rollback, SimState* sim, int tick, const float health[2], const int score[2]);
+void RollbackAdvance(Rollback* rollback, SimState* sim, int targetTick);
+void RollbackFree(Rollback* rollback);
+
+#endif
@@ -0,0 +1,239 @@
+#include "sim.h"
+#include "rollback.h"
+#include "protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Headless rollback check: plays bot-vs-bot matches twice, once through
+// plain SimStep with every press at its own tick, as the server would judge
+// them, and once through the client's rollback, which gets its own presses at
+// once and the server's judgments and snapshots late and out of order. Once
+// every judgment up to a saved tick has arrived, the rollback's save for that
+// tick has to equal the plain run's state there.
+
+#define DEFAULT_MATCHES 20
+#define MAX_MATCH_TICKS SIM_TICKS(300.0f) // Safety cap so a stalemate cannot hang the run
+#define FRAME_TICKS 16                     // Client frame, in ticks
+#define SNAPSHOT_TICKS 33                  // Server snapshot interval, in ticks
+#define MAX_EVENTS 4096                    // Judgments and snapshots on the way to the client
+#define MAX_BOT_PRESSES 64
+#define BOT_EARLY_TICKS 100                // Bots press up to this early...
+#define BOT_LATE_TICKS 150                 // ...or this late, which predictions get wrong
+#define DEFAULT_SKIP_PERCENT 0             // Arrows a bot lets through
+#define HISTORY_SAVES 256                  // Plain-run states kept, one per save interval
+#define HIT_WINDOW_TICKS ((int)(GOOD_THRESHOLD / ARROW_SPEED * SIM_TICK_RATE) + 1)
+
+// A judgment or snapshot on its way to the client
+typedef struct {
+    int due;      // Tick it arrives at
+    bool snapshot;
+    int tick;
+    int player;
+    int lane;
+    Judgment result;
+    float health[2];
+    int score[2];
+} Event;
+
+// A press a bot will make at `tick`
+typedef struct {
+    int tick;
+    int lane;
+} BotPress;
+
+typedef struct {
+    BotPress presses[MAX_BOT_PRESSES];
+    int count;
+    float scheduled[SIM_LANES]; // Hit time of the last arrow each lane has a press planned for
+} Bot;
+
+typedef struct {
+    long checks;
+    long mismatches;
+    long dropped;
+    long presses;
+} CheckStats;
+
+static int RandomTicks(int min, int max) {
+    return min + rand() % (max - min + 1);
+}
+
+// Function to plan a press for every arrow that spawned since the last call,
+// at the arrow's hit tick give or take the bot's error
+static void BotPlan(Bot* bot, const Player* player, int skipPercent) {
+    for (int lane = 0; lane < SIM_LANES; lane++) {
+        const ArrowRing* ring = &player->lanes[lane];
+        for (int i = 0; i < ring->count; i++) {
+            const Arrow* arrow = ArrowRingAt((ArrowRing*)ring, i);
+            if (!arrow->active || arrow->hitTime <= bot->scheduled[lane]) continue;
+            bot->scheduled[lane] = arrow->hitTime;
+            if (rand() % 100 < skipPercent || bot->count == MAX_BOT_PRESSES) continue;
+            int tick = SIM_TICKS(arrow->hitTime) + RandomTicks(-BOT_EARLY_TICKS, BOT_LATE_TICKS);
+            bot->presses[bot->count++] = (BotPress){ tick > 1 ? tick : 1, lane };
+        }
+    }
+}
+
+// Function to take the bot's next press due at `tick`, or -1
+static int BotTake(Bot* bot, int tick) {
+    for (int i = 0; i < bot->count; i++) {
+        if (bot->presses[i].tick > tick) continue;
+        int lane = bot->presses[i].lane;
+        bot->presses[i] = bot->presses[--bot->count];
+        return lane;
+    }
+    return -1;
+}
+
+static void Send(Event* events, int* count, Event event) {
+    if (*count < MAX_EVENTS) events[(*count)++] = event;
+}
+
+// Function to hand the rollback everything due by `tick`, in arrival order
+static void Deliver(Event* events, int* count, Rollback* rollback, SimState* client, int tick) {
+    for (;;) {
+        int next = -1;
+        for (int i = 0; i < *count; i++) {
+            if (events[i].due <= tick && (next == -1 || events[i].due < events[next].due)) next = i;
+        }
+        if (next == -1) return;
+        Event event = events[next];
+        events[next] = events[--*count];
+        if (event.snapshot) RollbackSnapshot(rollback, client, event.tick, event.health, event.score);
+        else RollbackJudged(rollback, client, event.player, event.tick, event.lane, event.result);
+    }
+}
+
+// Function to compare the rollback's save at `tick` with the plain run's state there
+static void CheckSave(const Rollback* rollback, const SimState* history, int tick, uint32_t seed, CheckStats* stats) {
+    const SimState* save = &rollback->states[(tick / ROLLBACK_SAVE_INTERVAL) % ROLLBACK_STATES];
+    const SimState* expected = &history[(tick / ROLLBACK_SAVE_INTERVAL) % HISTORY_SAVES];
+    if (save->tick != tick || expected->tick != tick) return;
+    stats->checks++;
+    for (int p = 0; p < 2; p++) {
+        if (save->players[p].health != expected->players[p].health || save->players[p].score != expected->players[p].score ||
+            save->players[p].perfectPresses != expected->players[p].perfectPresses) {
+            stats->mismatches++;
+            printf("seed %u tick %d player %d: rollback health %.1f score %d, plain run health %.1f score %d\n",
+                   seed, tick, p, save->players[p].health, save->players[p].score,
+                   expected->players[p].health, expected->players[p].score);
+            return;
+        }
+    }
+}
+
+// Function to play one match both ways and compare the rollback's saves with the plain run
+static void RunMatch(uint32_t seed, int delay, int jitter, int skipPercent, int dropPercent, Rollback* rollback, CheckStats* stats) {
+    static SimState history[HISTORY_SAVES];
+    static Event events[MAX_EVENTS];
+    SimState server, client;
+    SimInit(&server, seed);
+    SimInit(&client, seed);
+    RollbackReset(rollback, 1); // The client is the left player
+    for (int i = 0; i < HISTORY_SAVES; i++) history[i].tick = -1;
+    history[0] = server;
+    Bot bots[2] = {0};
+    int eventCount = 0;
+    int lastDue = 0;     // Latest arrival of a judgment sent so far
+    int settledTick = 0, knownTick = 0; // Last saves checked
+
+    for (int tick = 1; tick <= MAX_MATCH_TICKS && !server.over; tick++) {
+        // The plain run: the step, then the presses stamped with it, left player first
+        SimStep(&server, NULL);
+        for (int p = 0; p < 2; p++) {
+            BotPlan(&bots[p], &server.players[p], skipPercent);
+            int lane;
+            while ((lane = BotTake(&bots[p], tick)) != -1) {
+                stats->presses++;
+                if (p == 0) {
+                    RollbackLocalPress(rollback, &client, 0, tick, lane);
+                    if (rand() % 100 < dropPercent) {
+                        stats->dropped++; // Lost on the way: the server never judges it
+                        continue;
+                    }
+                }
+                Judgment result = JudgePress(&server.players[p], &server.players[1 - p], lane, tick * SIM_DT);
+                Event judgment = { .due = tick + delay + RandomTicks(0, jitter), .tick = tick, .player = p, .lane = lane, .result = result };
+                if (judgment.due > lastDue) lastDue = judgment.due;
+                Send(events, &eventCount, judgment);
+            }
+        }
+        if (tick % ROLLBACK_SAVE_INTERVAL == 0) history[(tick / ROLLBACK_SAVE_INTERVAL) % HISTORY_SAVES] = server;
+
+        if (tick % SNAPSHOT_TICKS == 0) {
+            Event snapshot = { .due = tick + delay > lastDue ? tick + delay : lastDue, .snapshot = true, .tick = tick };
+            for (int p = 0; p < 2; p++) {
+                snapshot.health[p] = server.players[p].health;
+                snapshot.score[p] = server.players[p].score;
+            }
+            Send(events, &eventCount, snapshot);
+        }
+
+        if (tick % FRAME_TICKS != 0) continue;
+        Deliver(events, &eventCount, rollback, &client, tick);
+        RollbackAdvance(rollback, &client, tick);
+
+        // Snapshots leave after the judgments before them, so up to the tick
+        // the last one settled every judgment has arrived and every
+        // prediction and lost press is taken back
+        int settled = rollback->confirmedTick / ROLLBACK_SAVE_INTERVAL * ROLLBACK_SAVE_INTERVAL;
+        if (settled > settledTick) {
+            settledTick = settled;
+            CheckSave(rollback, history, settled, seed, stats);
+        }
+
+        // When the opponent presses for every arrow, predictions may only stand
+        // in for presses still on the way: once every judgment within a hit
+        // window after a tick has arrived, the state there is already exact
+        int known = (tick - delay - jitter - HIT_WINDOW_TICKS) / ROLLBACK_SAVE_INTERVAL * ROLLBACK_SAVE_INTERVAL;
+        if (skipPercent == 0 && dropPercent == 0 && known > knownTick && known > settledTick) {
+            knownTick = known;
+            CheckSave(rollback, history, known, seed, stats);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int delay = 20, jitter = 30, skipPercent = DEFAULT_SKIP_PERCENT, dropPercent = 0;
+    int option;
+    while ((option = getopt(argc, argv, "d:j:s:l:")) != -1) {
+        switch (option) {
+            case 'd': delay = atoi(optarg); break;
+            case 'j': jitter = atoi(optarg); break;
+            case 's': skipPercent = atoi(optarg); break;
+            case 'l': dropPercent = atoi(optarg); break;
+            default: delay = -1; break;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    int matches = argc > 1 ? atoi(argv[1]) : DEFAULT_MATCHES;
+    unsigned int seed = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 1;
+    if (matches <= 0 || delay < 0 || jitter < 0 || skipPercent < 0 || dropPercent < 0) {
+        fprintf(stderr, "usage: %s [-d delay_ticks] [-j jitter_ticks] [-s skipped_percent] [-l lost_percent] [matches] [seed]\n", argv[0]);
+        return 1;
+    }
+    if (delay + jitter >= PROTO_MAX_INPUT_LAG_MS * SIM_TICK_RATE / 1000) {
+        fprintf(stderr, "delay + jitter must stay under %d ms, the server judges later presses late\n", PROTO_MAX_INPUT_LAG_MS);
+        return 1;
+    }
+
+    Rollback rollback;
+    if (!RollbackInit(&rollback)) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    srand(seed);
+    CheckStats stats = {0};
+    for (int m = 0; m < matches; m++) RunMatch(seed + (unsigned int)m, delay, jitter, skipPercent, dropPercent, &rollback, &stats);
+
+    const RollbackStats* rs = &rollback.stats;
+    printf("%d matches, %ld presses (%ld lost), %ld saves checked, %ld mismatches\n",
+           matches, stats.presses, stats.dropped, stats.checks, stats.mismatches);
+    printf("rollback: %ld rewinds, %ld late, %ld desyncs, %ld folded, max %d ticks redone\n",
+           rs->rewinds, rs->late, rs->desyncs, rs->folded, rs->maxTicks);
+    RollbackFree(&rollback);
+    return stats.mismatches == 0 && rs->desyncs == 0 ? 0 : 1;
+}
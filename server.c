@@ -2,219 +2,1074 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <time.h>
+
+#define PROTO_DECODER_SIZE 1024
+#include "protocol.h"
+#include "channel.h"
+#include "sim.h"
 
 #define PORT 8080
-#define MAX_CLIENTS 2
-#define BUFFER_SIZE 1024
+#define PLAYERS_PER_ROOM 2
+#define OUT_BUFFER_SIZE 2048
+#define MAX_EVENTS 256
+#define ROOM_SLAB_SIZE 256     // Rooms are allocated in slabs and recycled through a free list
+#define HANDOFF_QUEUE_SIZE 1024
+#define STATS_INTERVAL_MS 5000
+#define TICK_RATE 30           // Room snapshots per second
+#define SLOW_CLIENT_TICKS (TICK_RATE * 3) // Ticks a client may sit on an unsent snapshot before eviction
+#define MAX_PENDING_INPUTS 32  // Presses a client may send within one tick
+#define MAX_INPUT_LAG (PROTO_MAX_INPUT_LAG_MS * SIM_TICK_RATE / 1000) // Oldest press the server still judges, in sim ticks
+#define UDP_BUCKETS 4096       // Address hash buckets per worker, a power of two
+#define UDP_PAIRED_SLOTS 16384 // Lobby's memory of paired UDP sessions, a power of two
+#define UDP_PAIRED_PROBES 16
+#define UDP_WAITING_STALE_MS (CHANNEL_KEEPALIVE_MS * 4) // A waiting UDP client this quiet has left
+
+typedef struct Room Room;
+typedef struct Worker Worker;
 
+// A press waiting for the room's next tick
 typedef struct {
-    int socket;
+    uint32_t tick;
+    int lane;
+} PendingInput;
+
+typedef struct Client Client;
+
+struct Client {
+    int socket;    // UDP clients share their worker's socket
     int id;
     float health;
     int score;
     bool ready;
-} Client;
+    bool closing;  // Close once the output buffer has drained
+    bool want_write;
+    Room* room;
+    ProtoDecoder in;
+    char out[OUT_BUFFER_SIZE];  // Control messages, sent in order
+    size_t out_len;
+    MsgSnapshot snapshot;       // Latest room snapshot; a newer one replaces it until sending starts
+    size_t snapshot_len;        // 0 when no snapshot is queued
+    size_t snapshot_sent;
+    int stalled_ticks;          // Consecutive ticks that found the previous snapshot still queued
+    PendingInput inputs[MAX_PENDING_INPUTS];
+    int input_count;
 
-typedef struct {
-    Client clients[MAX_CLIENTS];
-    int client_count;
-    pthread_mutex_t mutex;
+    // UDP transport: control messages go through the channel, and the latest
+    // snapshot rides in every packet until one carrying it is acked
+    bool udp;
+    struct sockaddr_in address;
+    long last_heard_ms;
+    uint16_t snapshot_packet;   // Last packet the queued snapshot went out in
+    bool snapshot_carried;
+    Client* next_hash;
+    Client* prev_udp;
+    Client* next_udp;
+    Channel channel;
+};
+
+// One 2-player match, owned by exactly one worker thread
+struct Room {
+    Client clients[PLAYERS_PER_ROOM];
+    int open_clients;  // Sockets not yet cleaned up
     bool game_started;
+    bool dirty;        // On the worker's dirty list, waiting for the next tick
+    Room* next_dirty;
+    Room* next_free;
+    Room* prev_playing; // Links on the worker's list of rooms with a match running
+    Room* next_playing;
+    SimState sim;       // The authoritative match, judged only here
+    uint32_t sim_tick;
+    long start_ms;
+};
+
+// A freshly matched pair travelling from the lobby to a worker: two TCP
+// sockets, or for a UDP pair (sockets -1) the clients' addresses and sessions
+typedef struct {
+    int sockets[PLAYERS_PER_ROOM];
+    struct sockaddr_in addresses[PLAYERS_PER_ROOM];
+    uint32_t sessions[PLAYERS_PER_ROOM];
+} Handoff;
+
+// A worker runs its own epoll loop over the rooms it owns; nothing in a room is shared
+struct Worker {
+    pthread_t thread;
+    int epoll_fd;
+    int wake_fd;  // eventfd the lobby pokes after queueing a handoff
+    int tick_fd;  // timerfd firing TICK_RATE times a second
+    uint32_t tick;
+    Room* dirty_rooms;  // Rooms with updates since the last tick
+    Room* playing_rooms;
+    uint32_t seed_rng;  // Source of per-match chart seeds
+
+    pthread_mutex_t handoff_mutex;  // Only guards the queue below, between lobby and this worker
+    Handoff handoffs[HANDOFF_QUEUE_SIZE];
+    int handoff_count;
+
+    int udp_fd;               // UDP socket on a port of its own; the lobby's pairs are answered from it
+    Client* udp_buckets[UDP_BUCKETS]; // UDP clients by address
+    Client* udp_clients;      // Every UDP client, for resends and timeouts
+
+    Room* free_rooms;
+    atomic_int active_rooms;
+    atomic_long messages;
+    atomic_long snapshots;  // Snapshots queued to clients
+    atomic_long coalesced;  // Queued snapshots replaced by a newer one before they went out
+    atomic_long evictions;  // Clients dropped for falling behind
+    atomic_long judgments;  // Presses judged
+    atomic_int udp_count;   // UDP clients connected
+    atomic_long resent;     // Reliable messages repeated to UDP clients
+};
+
+// A UDP session the lobby has handed to a worker; its hellos still in flight are ignored
+typedef struct {
+    uint32_t session;
+    long paired_ms;  // 0 for a free slot
+} PairedSession;
+
+typedef struct {
+    Worker* workers;
+    int worker_count;
+    int next_worker;
+    int waiting_socket;  // Lobby: a connected player still looking for an opponent
+    int udp_socket;      // Lobby: where UDP clients say hello, on the server's port
+    int spare_fd;        // Lobby: given up to accept and close a connection when out of descriptors
+    bool udp_waiting;    // Lobby: a UDP client still looking for an opponent
+    struct sockaddr_in udp_waiting_address;
+    uint32_t udp_waiting_session;
+    long udp_waiting_ms; // Its last hello
+    PairedSession paired[UDP_PAIRED_SLOTS];
     bool server_running;
-} GameState;
+} ServerState;
 
-GameState game_state = {0};
+ServerState server_state = { .waiting_socket = -1, .spare_fd = -1 };
 
-void cleanup_client(int client_socket) {
-    close(client_socket);
-    pthread_mutex_lock(&game_state.mutex);
-    for (int i = 0; i < game_state.client_count; i++) {
-        if (game_state.clients[i].socket == client_socket) {
-            for (int j = i; j < game_state.client_count - 1; j++) {
-                game_state.clients[j] = game_state.clients[j + 1];
-            }
-            game_state.client_count--;
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Function to take a room from the worker's free list, growing it by a slab when empty
+static Room* alloc_room(Worker* worker) {
+    if (worker->free_rooms == NULL) {
+        Room* slab = calloc(ROOM_SLAB_SIZE, sizeof(Room));
+        if (slab == NULL) return NULL;
+        for (int i = 0; i < ROOM_SLAB_SIZE; i++) {
+            slab[i].next_free = worker->free_rooms;
+            worker->free_rooms = &slab[i];
+        }
+    }
+    Room* room = worker->free_rooms;
+    worker->free_rooms = room->next_free;
+    memset(room, 0, sizeof(*room));
+    atomic_fetch_add(&worker->active_rooms, 1);
+    return room;
+}
+
+static void link_playing(Worker* worker, Room* room) {
+    room->prev_playing = NULL;
+    room->next_playing = worker->playing_rooms;
+    if (worker->playing_rooms != NULL) worker->playing_rooms->prev_playing = room;
+    worker->playing_rooms = room;
+}
+
+static void unlink_playing(Worker* worker, Room* room) {
+    if (room->prev_playing != NULL) room->prev_playing->next_playing = room->next_playing;
+    else if (worker->playing_rooms == room) worker->playing_rooms = room->next_playing;
+    else return;  // Not on the list
+    if (room->next_playing != NULL) room->next_playing->prev_playing = room->prev_playing;
+    room->prev_playing = room->next_playing = NULL;
+}
+
+static void free_room(Worker* worker, Room* room) {
+    unlink_playing(worker, room);
+    room->next_free = worker->free_rooms;
+    worker->free_rooms = room;
+    atomic_fetch_sub(&worker->active_rooms, 1);
+}
+
+static uint32_t udp_hash(const struct sockaddr_in* address) {
+    uint32_t key = address->sin_addr.s_addr ^ (uint32_t)address->sin_port * 0x9E3779B9u;
+    return (key ^ (key >> 16)) & (UDP_BUCKETS - 1);
+}
+
+static Client* udp_lookup(Worker* worker, const struct sockaddr_in* address) {
+    for (Client* client = worker->udp_buckets[udp_hash(address)]; client != NULL; client = client->next_hash) {
+        if (client->address.sin_addr.s_addr == address->sin_addr.s_addr && client->address.sin_port == address->sin_port) return client;
+    }
+    return NULL;
+}
+
+static void udp_link(Worker* worker, Client* client) {
+    Client** bucket = &worker->udp_buckets[udp_hash(&client->address)];
+    client->next_hash = *bucket;
+    *bucket = client;
+
+    client->prev_udp = NULL;
+    client->next_udp = worker->udp_clients;
+    if (worker->udp_clients != NULL) worker->udp_clients->prev_udp = client;
+    worker->udp_clients = client;
+    atomic_fetch_add(&worker->udp_count, 1);
+}
+
+static void udp_unlink(Worker* worker, Client* client) {
+    for (Client** link = &worker->udp_buckets[udp_hash(&client->address)]; *link != NULL; link = &(*link)->next_hash) {
+        if (*link == client) {
+            *link = client->next_hash;
             break;
         }
     }
-    pthread_mutex_unlock(&game_state.mutex);
+
+    if (client->prev_udp != NULL) client->prev_udp->next_udp = client->next_udp;
+    else worker->udp_clients = client->next_udp;
+    if (client->next_udp != NULL) client->next_udp->prev_udp = client->prev_udp;
+    client->prev_udp = client->next_udp = NULL;
+    atomic_fetch_sub(&worker->udp_count, 1);
+}
+
+// Function to send a UDP client one packet: its unacked control messages,
+// the queued snapshot and, when given, a pong
+static void udp_flush(Worker* worker, Client* client, const Message* pong) {
+    Message unreliable[2];
+    int count = 0;
+    if (client->snapshot_len > 0) unreliable[count++].snapshot = client->snapshot;
+    if (pong != NULL) unreliable[count++] = *pong;
+
+    uint8_t packet[CHANNEL_PACKET_SIZE];
+    uint16_t sequence = client->channel.sequence;
+    long resent = client->channel.stats.resent;
+    bool carried;
+    size_t len = ChannelWrite(&client->channel, packet, unreliable, count, &carried, now_ns());
+    if (carried && client->snapshot_len > 0) {
+        client->snapshot_packet = sequence;
+        client->snapshot_carried = true;
+    }
+    atomic_fetch_add_explicit(&worker->resent, client->channel.stats.resent - resent, memory_order_relaxed);
+
+    // A full socket buffer loses the packet the way the network would, and the channel recovers it the same way
+    sendto(worker->udp_fd, packet, len, 0, (struct sockaddr*)&client->address, sizeof(client->address));
+}
+
+static size_t pending_output(const Client* client) {
+    return client->out_len + client->snapshot_len - client->snapshot_sent;
+}
+
+// Only ask epoll for writability while there is something queued
+static void update_interest(Worker* worker, Client* client) {
+    bool want_write = pending_output(client) > 0;
+    if (want_write == client->want_write) return;
+
+    struct epoll_event ev = { .events = EPOLLIN | (want_write ? EPOLLOUT : 0), .data.ptr = client };
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, client->socket, &ev);
+    client->want_write = want_write;
+}
+
+// Function to account for `sent` bytes written from the front of the output
+static void consume_output(Client* client, size_t sent, bool snapshot_first) {
+    for (int part = 0; part < 2 && sent > 0; part++) {
+        if ((part == 0) == snapshot_first) {
+            size_t n = client->snapshot_len - client->snapshot_sent;
+            if (n > sent) n = sent;
+            client->snapshot_sent += n;
+            if (client->snapshot_sent == client->snapshot_len) client->snapshot_len = client->snapshot_sent = 0;
+            sent -= n;
+        } else {
+            size_t n = client->out_len < sent ? client->out_len : sent;
+            memmove(client->out, client->out + n, client->out_len - n);
+            client->out_len -= n;
+            sent -= n;
+        }
+    }
+}
+
+// Write control messages and the queued snapshot in one writev, keep what the socket refuses
+static bool flush_client(Worker* worker, Client* client) {
+    while (pending_output(client) > 0) {
+        // A snapshot already partly on the wire has to finish before anything else goes out
+        bool snapshot_first = client->snapshot_sent > 0;
+        struct iovec control = { client->out, client->out_len };
+        struct iovec snapshot = { (char*)&client->snapshot + client->snapshot_sent, client->snapshot_len - client->snapshot_sent };
+        struct iovec iov[2];
+        int count = 0;
+        if (snapshot_first) {
+            iov[count++] = snapshot;
+            if (control.iov_len > 0) iov[count++] = control;
+        } else {
+            if (control.iov_len > 0) iov[count++] = control;
+            if (snapshot.iov_len > 0) iov[count++] = snapshot;
+        }
+
+        ssize_t sent = writev(client->socket, iov, count);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return false;
+        }
+        consume_output(client, sent, snapshot_first);
+    }
+
+    if (pending_output(client) == 0) client->stalled_ticks = 0;
+    update_interest(worker, client);
+    return true;
+}
+
+// Close after the queued output is sent. Clients are only cleaned up from their
+// own epoll event, so an already drained socket is shut down to raise one.
+// UDP clients are cleaned up by the tick once the peer has acked everything.
+static void close_when_flushed(Client* client) {
+    client->closing = true;
+    if (!client->udp && pending_output(client) == 0) shutdown(client->socket, SHUT_RDWR);
+}
+
+// Drop whatever is queued and close: the client is too slow or already gone
+static void evict_client(Worker* worker, Client* client) {
+    client->out_len = 0;
+    client->snapshot_len = client->snapshot_sent = 0;
+    if (client->udp) ChannelDiscard(&client->channel);
+    atomic_fetch_add_explicit(&worker->evictions, 1, memory_order_relaxed);
+    close_when_flushed(client);
+}
+
+// Queue a message, a client whose buffer overflows is too slow and gets dropped
+void send_to_client(Worker* worker, Client* client, const Message* message) {
+    size_t len = message->header.length;
+    if (client->closing) return;
+    if (client->udp) {
+        // Goes out with the next packet, and with every one after until acked
+        if (!ChannelSend(&client->channel, message)) evict_client(worker, client);
+        return;
+    }
+    if (client->out_len + len > OUT_BUFFER_SIZE) {
+        evict_client(worker, client);
+        return;
+    }
+    memcpy(client->out + client->out_len, message, len);
+    client->out_len += len;
+    if (!flush_client(worker, client)) evict_client(worker, client);
+}
+
+// Queue a room snapshot. Snapshots carry the whole state, so an unsent older
+// one is simply replaced; false when one is mid-write and this must wait a tick.
+static bool send_snapshot(Worker* worker, Client* client, const MsgSnapshot* snapshot) {
+    if (client->socket == -1 || client->closing) return true;
+
+    if (client->udp) {
+        // Never waits: the tick's packet carries it, and an unacked older one is dropped
+        client->snapshot = *snapshot;
+        client->snapshot_len = sizeof(*snapshot);
+        client->snapshot_carried = false;
+        atomic_fetch_add_explicit(&worker->snapshots, 1, memory_order_relaxed);
+        return true;
+    }
+
+    if (client->snapshot_len > 0) {
+        if (++client->stalled_ticks > SLOW_CLIENT_TICKS) {
+            evict_client(worker, client);
+            return true;
+        }
+        if (client->snapshot_sent > 0) return false;
+        atomic_fetch_add_explicit(&worker->coalesced, 1, memory_order_relaxed);
+    }
+
+    client->snapshot = *snapshot;
+    client->snapshot_len = sizeof(*snapshot);
+    client->snapshot_sent = 0;
+    atomic_fetch_add_explicit(&worker->snapshots, 1, memory_order_relaxed);
+    if (!flush_client(worker, client)) evict_client(worker, client);
+    return true;
 }
 
-void broadcast_message(const char* message, int exclude_socket) {
-    pthread_mutex_lock(&game_state.mutex);
-    for (int i = 0; i < game_state.client_count; i++) {
-        if (game_state.clients[i].socket != exclude_socket) {
-            send(game_state.clients[i].socket, message, strlen(message), 0);
+void broadcast_message(Worker* worker, Room* room, const Message* message, Client* exclude) {
+    for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+        Client* client = &room->clients[i];
+        if (client != exclude && client->socket != -1) {
+            send_to_client(worker, client, message);
         }
     }
-    pthread_mutex_unlock(&game_state.mutex);
 }
 
-void broadcast_game_state(int sender_socket) {
-    char buffer[BUFFER_SIZE];
-    pthread_mutex_lock(&game_state.mutex);
-    
-    for (int i = 0; i < game_state.client_count; i++) {
-        if (game_state.clients[i].socket != sender_socket) {
-            for (int j = 0; j < game_state.client_count; j++) {
-                if (game_state.clients[j].socket == sender_socket) {
-                    snprintf(buffer, BUFFER_SIZE, "STATE %d %.2f %d",
-                            game_state.clients[j].id,
-                            game_state.clients[j].health,
-                            game_state.clients[j].score);
-                    send(game_state.clients[i].socket, buffer, strlen(buffer), 0);
-                    break;
-                }
+// Function to queue a room for the next tick's snapshot
+static void mark_dirty(Worker* worker, Room* room) {
+    if (room->dirty) return;
+    room->dirty = true;
+    room->next_dirty = worker->dirty_rooms;
+    worker->dirty_rooms = room;
+}
+
+// Function to hold a press for the next tick. Stamps come from the client's
+// clock, so they are clamped: no pressing ahead of the match, nor too far back.
+// A press that cannot be judged is rejected back to its player, whose client
+// would otherwise keep counting it.
+static void queue_input(Worker* worker, Client* client, const MsgInput* input) {
+    Room* room = client->room;
+    if (!room->game_started || room->sim.over || input->lane >= SIM_LANES || client->input_count == MAX_PENDING_INPUTS) {
+        Message rejection;
+        ProtoInit(&rejection, MSG_JUDGMENT);
+        rejection.judgment.tick = input->tick;
+        rejection.judgment.player = (uint8_t)(client - room->clients + 1);
+        rejection.judgment.lane = input->lane;
+        rejection.judgment.result = PROTO_REJECTED;
+        send_to_client(worker, client, &rejection);
+        return;
+    }
+
+    long now_tick = (now_ms() - room->start_ms) * SIM_TICK_RATE / 1000;
+    long tick = input->tick;
+    if (tick > now_tick) tick = now_tick;
+    if (tick < now_tick - MAX_INPUT_LAG) tick = now_tick - MAX_INPUT_LAG;
+    if (tick < 0) tick = 0;
+
+    client->inputs[client->input_count++] = (PendingInput){ .tick = (uint32_t)tick, .lane = input->lane };
+}
+
+// Function to run a room's match up to the present, judging the presses
+// queued since the last tick as their stamps come due. Between presses the
+// match runs with SimAdvance, which skips the ticks where nothing happens.
+static void advance_room(Worker* worker, Room* room, long now) {
+    uint32_t target = (uint32_t)((now - room->start_ms) * SIM_TICK_RATE / 1000);
+    int cursor[PLAYERS_PER_ROOM] = {0};
+
+    while (room->sim_tick < target && !room->sim.over) {
+        // A press is judged right after the step it is stamped with, or the next one
+        uint32_t until = target;
+        for (int p = 0; p < PLAYERS_PER_ROOM; p++) {
+            const Client* client = &room->clients[p];
+            if (cursor[p] == client->input_count) continue;
+            uint32_t due = client->inputs[cursor[p]].tick > room->sim_tick ? client->inputs[cursor[p]].tick : room->sim_tick + 1;
+            if (due < until) until = due;
+        }
+        SimAdvance(&room->sim, (int)until);
+        room->sim_tick = (uint32_t)room->sim.tick;
+
+        for (int p = 0; p < PLAYERS_PER_ROOM; p++) {
+            Client* client = &room->clients[p];
+            while (cursor[p] < client->input_count && client->inputs[cursor[p]].tick <= room->sim_tick) {
+                PendingInput* input = &client->inputs[cursor[p]++];
+                Judgment result = JudgePress(&room->sim.players[p], &room->sim.players[1 - p], input->lane, input->tick * SIM_DT);
+                atomic_fetch_add_explicit(&worker->judgments, 1, memory_order_relaxed);
+
+                Message judgment;
+                ProtoInit(&judgment, MSG_JUDGMENT);
+                judgment.judgment.tick = input->tick;
+                judgment.judgment.player = (uint8_t)(p + 1);
+                judgment.judgment.lane = (uint8_t)input->lane;
+                judgment.judgment.result = (uint8_t)result;
+                broadcast_message(worker, room, &judgment, NULL);
+                mark_dirty(worker, room);
             }
         }
+        if (room->sim.over) mark_dirty(worker, room);
+    }
+
+    // Stamps never run ahead of the match, so every queued press has been judged
+    for (int p = 0; p < PLAYERS_PER_ROOM; p++) {
+        Client* client = &room->clients[p];
+        client->health = room->sim.players[p].health;
+        client->score = room->sim.players[p].score;
+        client->input_count = 0;
     }
-    
-    pthread_mutex_unlock(&game_state.mutex);
 }
 
-void check_game_start() {
-    pthread_mutex_lock(&game_state.mutex);
-    if (game_state.client_count == MAX_CLIENTS) {
-        bool all_ready = true;
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (!game_state.clients[i].ready) {
-                all_ready = false;
-                break;
+// Tick: every room that changed gets one snapshot, built once and queued to
+// each player. Rooms whose last socket closed while dirty are released here.
+static void run_tick(Worker* worker) {
+    uint64_t expirations;
+    while (read(worker->tick_fd, &expirations, sizeof(expirations)) > 0) {}
+
+    worker->tick++;
+
+    // Judge every running match in one pass before building snapshots
+    long now = now_ms();
+    for (Room* playing = worker->playing_rooms; playing != NULL;) {
+        Room* next = playing->next_playing;
+        advance_room(worker, playing, now);
+        if (playing->sim.over) unlink_playing(worker, playing);
+        playing = next;
+    }
+
+    Room* room = worker->dirty_rooms;
+    worker->dirty_rooms = NULL;
+
+    while (room != NULL) {
+        Room* next = room->next_dirty;
+        room->dirty = false;
+
+        if (room->open_clients > 0) {
+            Message snapshot;
+            ProtoInit(&snapshot, MSG_SNAPSHOT);
+            snapshot.snapshot.tick = room->sim_tick;
+            for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+                snapshot.snapshot.players[i].health = room->clients[i].health;
+                snapshot.snapshot.players[i].score = room->clients[i].score;
+            }
+
+            bool delivered = true;
+            for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+                if (!send_snapshot(worker, &room->clients[i], &snapshot.snapshot)) delivered = false;
             }
+            if (!delivered) mark_dirty(worker, room);
+        } else {
+            free_room(worker, room);
+        }
+        room = next;
+    }
+}
+
+void check_game_start(Worker* worker, Room* room) {
+    for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+        if (!room->clients[i].ready) return;
+    }
+
+    if (!room->game_started) {
+        room->game_started = true;
+        uint32_t seed = SimRandom(&worker->seed_rng);
+        SimInit(&room->sim, seed);
+        room->sim_tick = 0;
+        room->start_ms = now_ms();
+        link_playing(worker, room);
+
+        Message start;
+        ProtoInit(&start, MSG_START);
+        start.start.seed = seed;
+        broadcast_message(worker, room, &start, NULL);
+    }
+}
+
+void handle_message(Worker* worker, Client* client, const Message* msg) {
+    switch (msg->header.type) {
+        case MSG_READY:
+            client->ready = true;
+            check_game_start(worker, client->room);
+            break;
+        case MSG_INPUT:
+            queue_input(worker, client, &msg->input);
+            break;
+        case MSG_PING: {
+            Message pong = *msg;
+            pong.header.type = MSG_PONG;
+            if (client->udp) udp_flush(worker, client, &pong);  // Unreliable: a resent echo would measure the resend
+            else send_to_client(worker, client, &pong);
+            break;
+        }
+    }
+}
+
+// Drain the socket into the client's decoder; returns false once the peer is gone
+static bool handle_readable(Worker* worker, Client* client) {
+    while (true) {
+        size_t space;
+        uint8_t* dst = ProtoDecoderSpace(&client->in, &space);
+        ssize_t bytes_received = recv(client->socket, dst, space, 0);
+        if (bytes_received == 0) return false;
+        if (bytes_received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if (errno == EINTR) continue;
+            return false;
+        }
+        ProtoDecoderCommit(&client->in, bytes_received);
+
+        Message msg;
+        int result;
+        while ((result = ProtoDecoderNext(&client->in, &msg)) == 1) {
+            atomic_fetch_add_explicit(&worker->messages, 1, memory_order_relaxed);
+            handle_message(worker, client, &msg);
         }
-        
-        if (all_ready && !game_state.game_started) {
-            game_state.game_started = true;
-            printf("All players ready, starting game!\n");
-            broadcast_message("START", -1);
-        }
-    }
-    pthread_mutex_unlock(&game_state.mutex);
-}
-
-void* handle_client(void* arg) {
-    Client* client = (Client*)arg;
-    char buffer[BUFFER_SIZE];
-    
-    snprintf(buffer, BUFFER_SIZE, "ID %d", client->id);
-    send(client->socket, buffer, strlen(buffer), 0);
-    
-    while (game_state.server_running) {
-        int bytes_received = recv(client->socket, buffer, BUFFER_SIZE - 1, 0);
-        if (bytes_received <= 0) break;
-        
-        buffer[bytes_received] = '\0';
-        
-        if (strncmp(buffer, "READY", 5) == 0) {
-            pthread_mutex_lock(&game_state.mutex);
-            for (int i = 0; i < game_state.client_count; i++) {
-                if (game_state.clients[i].socket == client->socket) {
-                    game_state.clients[i].ready = true;
-                    printf("Client %d is ready\n", game_state.clients[i].id);
-                    break;
-                }
+        if (result < 0) return false;
+    }
+}
+
+// A match is over for both players once either leaves: the opponent is closed
+// too, and the room goes back to the free list when its last socket is gone
+void cleanup_client(Worker* worker, Client* client) {
+    Room* room = client->room;
+    if (client->udp) {
+        udp_unlink(worker, client);
+    } else {
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, client->socket, NULL);
+        close(client->socket);
+    }
+    client->socket = -1;
+
+    for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+        Client* other = &room->clients[i];
+        if (other->socket != -1 && !other->closing) close_when_flushed(other);
+    }
+
+    // A dirty room is still on the tick list, so the tick frees it instead
+    if (--room->open_clients == 0 && !room->dirty) free_room(worker, room);
+}
+
+// Function to set up a room for a lobby pair on this worker. A UDP pair hears
+// its ids from this worker's socket, and talks to it from then on.
+static void open_room(Worker* worker, const Handoff* handoff) {
+    bool udp = handoff->sockets[0] == -1;
+    Room* room = alloc_room(worker);
+    if (room == NULL) {
+        for (int i = 0; i < PLAYERS_PER_ROOM && !udp; i++) close(handoff->sockets[i]);
+        return;
+    }
+
+    for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+        Client* client = &room->clients[i];
+        client->socket = udp ? worker->udp_fd : handoff->sockets[i];
+        client->id = i + 1;
+        client->health = 100.0f;
+        client->room = room;
+        room->open_clients++;
+
+        if (udp) {
+            client->udp = true;
+            client->address = handoff->addresses[i];
+            client->last_heard_ms = now_ms();
+            ChannelInit(&client->channel, handoff->sessions[i]);
+            udp_link(worker, client);
+
+            Message id;
+            ProtoInit(&id, MSG_ID);
+            id.id.id = client->id;
+            send_to_client(worker, client, &id);
+            udp_flush(worker, client, NULL);
+            continue;
+        }
+
+        ProtoDecoderReset(&client->in);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = client };
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, client->socket, &ev) == -1) {
+            perror("epoll_ctl failed");
+        }
+    }
+}
+
+// Drain the worker's UDP socket. A packet goes to the client its source
+// address belongs to; anything else is left over from a finished match.
+static void handle_udp(Worker* worker) {
+    uint8_t packet[CHANNEL_PACKET_SIZE];
+    Message messages[CHANNEL_MAX_MESSAGES];
+    while (true) {
+        struct sockaddr_in address;
+        socklen_t address_len = sizeof(address);
+        ssize_t len = recvfrom(worker->udp_fd, packet, sizeof(packet), 0, (struct sockaddr*)&address, &address_len);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        Client* client = udp_lookup(worker, &address);
+        if (client == NULL) continue;
+
+        // A wrong session is the address's previous connection, and is refused here
+        int count = ChannelRead(&client->channel, packet, (size_t)len, now_ns(), messages, CHANNEL_MAX_MESSAGES);
+        if (count < 0) continue;
+        client->last_heard_ms = now_ms();
+        if (client->snapshot_carried && ChannelDelivered(&client->channel, client->snapshot_packet)) {
+            client->snapshot_len = 0;
+            client->snapshot_carried = false;
+        }
+
+        for (int i = 0; i < count; i++) {
+            atomic_fetch_add_explicit(&worker->messages, 1, memory_order_relaxed);
+            handle_message(worker, client, &messages[i]);
+        }
+        // Direct replies such as the id go out at once; judgments and snapshots wait for the tick
+        if (ChannelUnsent(&client->channel)) udp_flush(worker, client, NULL);
+    }
+}
+
+// After each tick's snapshots: resend what UDP clients have not acked, answer
+// owed acks, and drop clients that went silent or finished closing
+static void udp_tick(Worker* worker) {
+    long now = now_ms();
+    for (Client* client = worker->udp_clients; client != NULL;) {
+        Client* next = client->next_udp;
+        bool drained = !ChannelPending(&client->channel) && client->snapshot_len == 0;
+        if (now - client->last_heard_ms > CHANNEL_TIMEOUT_MS || (client->closing && drained)) cleanup_client(worker, client);
+        else if (!drained || client->channel.ackOwed) udp_flush(worker, client, NULL);
+        client = next;
+    }
+}
+
+static void drain_handoffs(Worker* worker) {
+    uint64_t wakeups;
+    while (read(worker->wake_fd, &wakeups, sizeof(wakeups)) > 0) {}
+
+    static __thread Handoff pending[HANDOFF_QUEUE_SIZE];
+    pthread_mutex_lock(&worker->handoff_mutex);
+    int count = worker->handoff_count;
+    memcpy(pending, worker->handoffs, count * sizeof(Handoff));
+    worker->handoff_count = 0;
+    pthread_mutex_unlock(&worker->handoff_mutex);
+
+    for (int i = 0; i < count; i++) open_room(worker, &pending[i]);
+}
+
+void* worker_thread(void* arg) {
+    Worker* worker = (Worker*)arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (server_state.server_running) {
+        int n = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &worker->wake_fd) {
+                drain_handoffs(worker);
+                continue;
             }
-            pthread_mutex_unlock(&game_state.mutex);
-            check_game_start();
-        }
-        else if (strncmp(buffer, "UPDATE", 6) == 0) {
-            float health;
-            int score;
-            if (sscanf(buffer, "UPDATE %f %d", &health, &score) == 2) {
-                pthread_mutex_lock(&game_state.mutex);
-                for (int i = 0; i < game_state.client_count; i++) {
-                    if (game_state.clients[i].socket == client->socket) {
-                        game_state.clients[i].health = health;
-                        game_state.clients[i].score = score;
-                        break;
-                    }
-                }
-                pthread_mutex_unlock(&game_state.mutex);
-                broadcast_game_state(client->socket);
+            if (events[i].data.ptr == &worker->tick_fd) {
+                run_tick(worker);
+                udp_tick(worker);
+                continue;
             }
+            if (events[i].data.ptr == &worker->udp_fd) {
+                handle_udp(worker);
+                continue;
+            }
+
+            Client* client = events[i].data.ptr;
+            if (client->socket == -1) continue;
+
+            bool alive = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) alive = false;
+            if (alive && (events[i].events & EPOLLIN)) alive = handle_readable(worker, client);
+            if (alive && (events[i].events & EPOLLOUT)) alive = flush_client(worker, client);
+            if (alive && client->closing && pending_output(client) == 0) alive = false;
+
+            if (!alive) cleanup_client(worker, client);
         }
     }
-    
-    printf("Client %d disconnected\n", client->id);
-    cleanup_client(client->socket);
     return NULL;
 }
 
-int main() {
+// Function to hand a matched pair to the next worker, round robin
+static void assign_room(const Handoff* handoff) {
+    Worker* worker = &server_state.workers[server_state.next_worker];
+    server_state.next_worker = (server_state.next_worker + 1) % server_state.worker_count;
+
+    pthread_mutex_lock(&worker->handoff_mutex);
+    bool queued = worker->handoff_count < HANDOFF_QUEUE_SIZE;
+    if (queued) {
+        worker->handoffs[worker->handoff_count++] = *handoff;
+    }
+    pthread_mutex_unlock(&worker->handoff_mutex);
+
+    if (!queued) {
+        // A UDP pair just stops hearing back and gives up on its own
+        for (int i = 0; i < PLAYERS_PER_ROOM && handoff->sockets[i] != -1; i++) close(handoff->sockets[i]);
+        return;
+    }
+    uint64_t one = 1;
+    if (write(worker->wake_fd, &one, sizeof(one)) < 0) perror("eventfd write failed");
+}
+
+// Lobby: the first player of a pair waits here, the second completes the room
+static void accept_clients(int server_socket, int lobby_epoll) {
+    while (true) {
+        struct sockaddr_in client_addr = {0};
+        socklen_t addr_len = sizeof(client_addr);
+
+        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &addr_len);
+        if (client_socket == -1) {
+            if (errno == EINTR) continue;
+            if ((errno == EMFILE || errno == ENFILE) && server_state.spare_fd != -1) {
+                // Out of descriptors: the listen socket stays readable and would
+                // wake the lobby forever. Free the spare to take the connection
+                // and close it, then take the spare back.
+                close(server_state.spare_fd);
+                client_socket = accept(server_socket, NULL, NULL);
+                if (client_socket != -1) close(client_socket);
+                server_state.spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                fprintf(stderr, "Out of file descriptors, connection refused\n");
+                if (client_socket != -1) continue;
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Accept failed");
+            return;
+        }
+        set_nonblocking(client_socket);
+        // Snapshots and judgments are small and due now; Nagle would hold them for the previous ack
+        int nodelay = 1;
+        setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        // A fresh socket's send buffer is empty, so the id goes out whole
+        Message id;
+        ProtoInit(&id, MSG_ID);
+        id.id.id = server_state.waiting_socket == -1 ? 1 : 2;
+        send(client_socket, &id, id.header.length, MSG_NOSIGNAL);
+
+        if (server_state.waiting_socket == -1) {
+            // Watch only for the peer hanging up; its messages wait in the socket for the worker
+            struct epoll_event ev = { .events = EPOLLRDHUP, .data.fd = client_socket };
+            epoll_ctl(lobby_epoll, EPOLL_CTL_ADD, client_socket, &ev);
+            server_state.waiting_socket = client_socket;
+        } else {
+            int first = server_state.waiting_socket;
+            epoll_ctl(lobby_epoll, EPOLL_CTL_DEL, first, NULL);
+            server_state.waiting_socket = -1;
+            assign_room(&(Handoff){ .sockets = { first, client_socket } });
+        }
+    }
+}
+
+// Function to find a paired UDP session's slot, or with `claim` a slot to record it in
+static PairedSession* paired_slot(uint32_t session, long now, bool claim) {
+    PairedSession* oldest = NULL;
+    for (int i = 0; i < UDP_PAIRED_PROBES; i++) {
+        PairedSession* slot = &server_state.paired[(session + i) & (UDP_PAIRED_SLOTS - 1)];
+        bool live = slot->paired_ms != 0 && now - slot->paired_ms <= CHANNEL_TIMEOUT_MS;
+        if (live && slot->session == session) return slot;
+        if (claim && !live) return slot;
+        if (oldest == NULL || slot->paired_ms < oldest->paired_ms) oldest = slot;
+    }
+    return claim ? oldest : NULL;
+}
+
+// UDP lobby: one socket on the server's port takes every hello, so any two
+// clients pair up whichever worker gets the room. The waiting client is sent
+// its id in lobby packets; a pair goes to a worker like a TCP pair does.
+static void accept_udp(void) {
+    uint8_t packet[CHANNEL_PACKET_SIZE];
+    while (true) {
+        struct sockaddr_in address;
+        socklen_t address_len = sizeof(address);
+        ssize_t len = recvfrom(server_state.udp_socket, packet, sizeof(packet), 0, (struct sockaddr*)&address, &address_len);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        uint32_t session;
+        bool hello;
+        long now = now_ms();
+        if (!ChannelPeek(packet, (size_t)len, &session, &hello) || !hello) continue;
+        if (paired_slot(session, now, false) != NULL) continue;  // Sent before its worker's first packet arrived
+
+        bool waiting = server_state.udp_waiting && now - server_state.udp_waiting_ms <= UDP_WAITING_STALE_MS;
+        if (!waiting || server_state.udp_waiting_session == session) {
+            server_state.udp_waiting = true;
+            server_state.udp_waiting_address = address;
+            server_state.udp_waiting_session = session;
+            server_state.udp_waiting_ms = now;
+
+            Message id;
+            ProtoInit(&id, MSG_ID);
+            id.id.id = 1;
+            size_t reply = ChannelWriteLobby(packet, session, &id);
+            sendto(server_state.udp_socket, packet, reply, 0, (struct sockaddr*)&address, sizeof(address));
+            continue;
+        }
+
+        Handoff handoff = {
+            .sockets = { -1, -1 },
+            .addresses = { server_state.udp_waiting_address, address },
+            .sessions = { server_state.udp_waiting_session, session }
+        };
+        for (int i = 0; i < PLAYERS_PER_ROOM; i++) {
+            PairedSession* slot = paired_slot(handoff.sessions[i], now, true);
+            slot->session = handoff.sessions[i];
+            slot->paired_ms = now;
+        }
+        server_state.udp_waiting = false;
+        assign_room(&handoff);
+    }
+}
+
+static void print_stats(long elapsed_ms, struct rusage* last_usage, long* last_messages) {
+    int rooms = 0;
+    int udp_clients = 0;
+    long messages = 0, snapshots = 0, coalesced = 0, evictions = 0, judgments = 0, resent = 0;
+    for (int i = 0; i < server_state.worker_count; i++) {
+        Worker* worker = &server_state.workers[i];
+        rooms += atomic_load(&worker->active_rooms);
+        messages += atomic_load(&worker->messages);
+        snapshots += atomic_load(&worker->snapshots);
+        coalesced += atomic_load(&worker->coalesced);
+        evictions += atomic_load(&worker->evictions);
+        judgments += atomic_load(&worker->judgments);
+        udp_clients += atomic_load(&worker->udp_count);
+        resent += atomic_load(&worker->resent);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu_ms = (usage.ru_utime.tv_sec - last_usage->ru_utime.tv_sec) * 1000.0 + (usage.ru_utime.tv_usec - last_usage->ru_utime.tv_usec) / 1000.0
+                  + (usage.ru_stime.tv_sec - last_usage->ru_stime.tv_sec) * 1000.0 + (usage.ru_stime.tv_usec - last_usage->ru_stime.tv_usec) / 1000.0;
+    double cores = elapsed_ms > 0 ? cpu_ms / elapsed_ms : 0.0;
+
+    if (rooms > 0 || messages != *last_messages) {
+        printf("rooms %d, %.0f msg/s, %.2f cores busy, %.0f rooms/core, %ld presses judged, snapshots %ld (%ld coalesced), %ld evicted, %d on UDP (%ld resent)\n",
+               rooms, (messages - *last_messages) * 1000.0 / elapsed_ms, cores, cores > 0.01 ? rooms / cores : 0.0,
+               judgments, snapshots, coalesced, evictions, udp_clients, resent);
+        fflush(stdout);
+    }
+    *last_usage = usage;
+    *last_messages = messages;
+}
+
+// Let one process hold as many sockets as the hard limit allows
+static void raise_fd_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
+
+    int worker_count = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (worker_count < 1) worker_count = 1;
+
     int server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket == -1) {
         perror("Socket creation failed");
         return EXIT_FAILURE;
     }
-    
+
     int opt = 1;
     if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
         perror("setsockopt failed");
         return EXIT_FAILURE;
     }
-    
+
     struct sockaddr_in server_addr = {0};
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(PORT);
-    
+
     if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
         perror("Bind failed");
         return EXIT_FAILURE;
     }
-    
-    if (listen(server_socket, MAX_CLIENTS) == -1) {
+
+    if (listen(server_socket, SOMAXCONN) == -1) {
         perror("Listen failed");
         return EXIT_FAILURE;
     }
-    
-    pthread_mutex_init(&game_state.mutex, NULL);
-    game_state.server_running = true;
-    game_state.game_started = false;
-    game_state.client_count = 0;
-    
-    printf("Server started on port %d\n", PORT);
-    
-    while (game_state.server_running) {
-        struct sockaddr_in client_addr = {0};
-        socklen_t addr_len = sizeof(client_addr);
-        
-        int client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &addr_len);
-        if (client_socket == -1) {
-            perror("Accept failed");
-            continue;
+    set_nonblocking(server_socket);
+    server_state.spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    server_state.server_running = true;
+    server_state.worker_count = worker_count;
+    server_state.workers = calloc(worker_count, sizeof(Worker));
+
+    for (int i = 0; i < worker_count; i++) {
+        Worker* worker = &server_state.workers[i];
+        worker->epoll_fd = epoll_create1(0);
+        worker->wake_fd = eventfd(0, EFD_NONBLOCK);
+        worker->tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        worker->udp_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (worker->epoll_fd == -1 || worker->wake_fd == -1 || worker->tick_fd == -1 || worker->udp_fd == -1) {
+            perror("Worker setup failed");
+            return EXIT_FAILURE;
         }
-        
-        if (game_state.client_count >= MAX_CLIENTS) {
-            const char* msg = "Server full";
-            send(client_socket, msg, strlen(msg), 0);
-            close(client_socket);
-            continue;
+
+        // Each worker answers its UDP pairs from a port of its own, picked by the kernel
+        int buffer = 1 << 20;
+        struct sockaddr_in worker_addr = { .sin_family = AF_INET, .sin_addr.s_addr = INADDR_ANY };
+        setsockopt(worker->udp_fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+        if (bind(worker->udp_fd, (struct sockaddr*)&worker_addr, sizeof(worker_addr)) == -1) {
+            perror("UDP bind failed");
+            return EXIT_FAILURE;
+        }
+        pthread_mutex_init(&worker->handoff_mutex, NULL);
+        worker->seed_rng = (uint32_t)time(NULL) ^ (uint32_t)(i + 1) * 0x9E3779B9u;
+
+        struct itimerspec period = { .it_interval.tv_nsec = 1000000000L / TICK_RATE, .it_value.tv_nsec = 1000000000L / TICK_RATE };
+        timerfd_settime(worker->tick_fd, 0, &period, NULL);
+
+        struct epoll_event wake_ev = { .events = EPOLLIN, .data.ptr = &worker->wake_fd };
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &wake_ev);
+        struct epoll_event tick_ev = { .events = EPOLLIN, .data.ptr = &worker->tick_fd };
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->tick_fd, &tick_ev);
+        struct epoll_event udp_ev = { .events = EPOLLIN, .data.ptr = &worker->udp_fd };
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->udp_fd, &udp_ev);
+        pthread_create(&worker->thread, NULL, worker_thread, worker);
+    }
+
+    int lobby_epoll = epoll_create1(0);
+    struct epoll_event listen_ev = { .events = EPOLLIN, .data.fd = server_socket };
+    epoll_ctl(lobby_epoll, EPOLL_CTL_ADD, server_socket, &listen_ev);
+
+    server_state.udp_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (server_state.udp_socket == -1 || bind(server_state.udp_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+        perror("UDP bind failed");
+        return EXIT_FAILURE;
+    }
+    struct epoll_event udp_ev = { .events = EPOLLIN, .data.fd = server_state.udp_socket };
+    epoll_ctl(lobby_epoll, EPOLL_CTL_ADD, server_state.udp_socket, &udp_ev);
+
+    printf("Server started on port %d (TCP and UDP) with %d worker(s)\n", PORT, worker_count);
+
+    struct rusage last_usage;
+    getrusage(RUSAGE_SELF, &last_usage);
+    long last_messages = 0;
+    long last_stats = now_ms();
+
+    struct epoll_event events[MAX_EVENTS];
+    while (server_state.server_running) {
+        long wait_ms = last_stats + STATS_INTERVAL_MS - now_ms();
+        int n = epoll_wait(lobby_epoll, events, MAX_EVENTS, wait_ms > 0 ? (int)wait_ms : 0);
+        if (n == -1 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
         }
-        
-        Client* new_client = malloc(sizeof(Client));
-        new_client->socket = client_socket;
-        new_client->id = game_state.client_count + 1;
-        new_client->health = 100.0f;
-        new_client->score = 0;
-        new_client->ready = false;
-        
-        pthread_mutex_lock(&game_state.mutex);
-        game_state.clients[game_state.client_count++] = *new_client;
-        printf("New client connected. Total clients: %d\n", game_state.client_count);
-        pthread_mutex_unlock(&game_state.mutex);
-        
-        pthread_t thread;
-        pthread_create(&thread, NULL, handle_client, new_client);
-        pthread_detach(thread);
-    }
-    
-    pthread_mutex_destroy(&game_state.mutex);
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == server_socket) {
+                accept_clients(server_socket, lobby_epoll);
+            } else if (events[i].data.fd == server_state.udp_socket) {
+                accept_udp();
+            } else if (events[i].data.fd == server_state.waiting_socket) {
+                // The waiting player left before an opponent arrived
+                epoll_ctl(lobby_epoll, EPOLL_CTL_DEL, server_state.waiting_socket, NULL);
+                close(server_state.waiting_socket);
+                server_state.waiting_socket = -1;
+            }
+        }
+
+        long now = now_ms();
+        if (now - last_stats >= STATS_INTERVAL_MS) {
+            print_stats(now - last_stats, &last_usage, &last_messages);
+            last_stats = now;
+        }
+    }
+
+    close(lobby_epoll);
+    close(server_state.udp_socket);
     close(server_socket);
+    if (server_state.spare_fd != -1) close(server_state.spare_fd);
     return 0;
 }
@@ -0,0 +1,265 @@
+#include "sim.h"
+#include <string.h>
+#include <math.h>
+
+#define FALL_TIME ((TARGET_ZONE_Y - ARROW_SPAWN_Y) / ARROW_SPEED)   // Spawn to target line
+#define EXPIRE_DELAY ((SCREEN_HEIGHT - TARGET_ZONE_Y) / ARROW_SPEED) // Target line to off screen
+
+// Function to draw the next number from a chart generator (xorshift32). Plain
+// 32-bit integer math, so a seed gives the same chart on every platform.
+uint32_t SimRandom(uint32_t* rng) {
+    uint32_t x = *rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *rng = x;
+    return x;
+}
+
+// Function to spawn a new arrow in a random lane, returning the lane
+int SpawnArrow(Player* player, bool isLeftSide, float time, uint32_t* rng) {
+    int direction = (int)(SimRandom(rng) >> 30); // Top bits, the best mixed ones
+    SpawnArrowInLane(player, isLeftSide, direction, time);
+    return direction;
+}
+
+// Function to spawn a new arrow into the lane queue of its direction
+void SpawnArrowInLane(Player* player, bool isLeftSide, int direction, float time) {
+    Arrow* arrow = ArrowRingPush(&player->lanes[direction]);
+    if (arrow == NULL) return;
+
+    arrow->direction = direction;
+
+    float xPos = isLeftSide ? SCREEN_WIDTH * 0.16f : SCREEN_WIDTH * 0.84f;
+
+    switch (arrow->direction) {
+        case 0: xPos -= 50; break;  // Up arrow
+        case 1: xPos += 50; break;  // Down arrow
+        case 2: xPos -= 150; break; // Left arrow
+        case 3: xPos += 150; break; // Right arrow
+    }
+
+    arrow->x = xPos;
+    arrow->hitTime = time + FALL_TIME;
+}
+
+// Function to find the arrow a press at `time` is judged against: the oldest one
+// in the lane that has not yet left the timing window, or -1 if none is inside it
+int FindJudgeTarget(ArrowRing* lane, float time) {
+    for (int i = 0; i < lane->count; i++) {
+        Arrow* arrow = ArrowRingAt(lane, i);
+        if (!arrow->active) continue;
+
+        float error = (time - arrow->hitTime) * ARROW_SPEED;
+        if (error >= GOOD_THRESHOLD) continue; // Already past the window, falling off screen
+        return -error < GOOD_THRESHOLD ? i : -1;
+    }
+    return -1;
+}
+
+// Function to get the combo text shown for a judgment
+const char* JudgmentText(Judgment judgment) {
+    switch (judgment) {
+        case JUDGE_PERFECT: return "PERFECT!";
+        case JUDGE_GOOD: return "GOOD!";
+        default: return "MISS!";
+    }
+}
+
+// Function to judge a press in one lane against the scheduled hit time of its next arrow
+Judgment JudgePress(Player* attacker, Player* defender, int pressedDir, float time) {
+    ArrowRing* lane = &attacker->lanes[pressedDir];
+    int targetIdx = FindJudgeTarget(lane, time);
+    Judgment judgment = JUDGE_MISS;
+
+    // Apply scoring based on timing
+    if (targetIdx != -1) {
+        float dist = fabsf(time - ArrowRingAt(lane, targetIdx)->hitTime) * ARROW_SPEED;
+
+        if (dist < PERFECT_THRESHOLD) {
+            attacker->score += 100;
+            defender->health -= PERFECT_DAMAGE;
+            if (defender->health < 0) defender->health = 0;
+            attacker->perfectPresses++;
+            judgment = JUDGE_PERFECT;
+        } else if ((pressedDir % 2 == 1 || pressedDir % 2 == 2) && dist < UP_DOWN_HITBOX) {
+            attacker->score += 50;
+            judgment = JUDGE_GOOD;
+        } else if ((pressedDir % 2 == 3 || pressedDir % 2 == 4) && dist < TIMING_RANGE) {
+            attacker->score += 50;
+            judgment = JUDGE_GOOD;
+        }
+
+        ArrowRingRemove(lane, targetIdx);
+    }
+
+    strcpy(attacker->combo, JudgmentText(judgment));
+    return judgment;
+}
+
+// Function to reset a match to its starting state with the chart for `seed`
+void SimInit(SimState* state, uint32_t seed) {
+    memset(state, 0, sizeof(*state));
+    for (int p = 0; p < 2; p++) {
+        state->players[p].health = 100.0f;
+        strcpy(state->players[p].combo, "READY!");
+    }
+    state->spawnIntervalTicks = SIM_TICKS(INITIAL_SPAWN_INTERVAL);
+    state->nextSpawnTick = state->spawnIntervalTicks;
+
+    // Scramble the seed so neighbouring seeds give unrelated charts; xorshift needs a nonzero state
+    seed ^= seed >> 16;
+    seed *= 0x85EBCA6Bu;
+    seed ^= seed >> 13;
+    seed *= 0xC2B2AE35u;
+    seed ^= seed >> 16;
+    state->rng = seed != 0 ? seed : 0x9E3779B9u;
+}
+
+// Function to play a chart instead of generated arrows; call right after SimInit
+void SimUseChart(SimState* state, const Chart* chart) {
+    state->chart = chart;
+    memset(state->chartCursor, 0, sizeof(state->chartCursor));
+}
+
+// Function to spawn every chart note due on screen by now, for both players.
+// Each lane's notes are sorted, so a cursor per lane is all the lookup needed.
+static void SpawnChartNotes(SimState* state) {
+    const float fallTime = FALL_TIME;
+    const ChartHeader* header = state->chart->header;
+
+    for (int lane = 0; lane < SIM_LANES; lane++) {
+        const ChartNote* notes = state->chart->notes[lane];
+        uint32_t* cursor = &state->chartCursor[lane];
+
+        while (*cursor < header->noteCount[lane] && notes[*cursor].timeUs / 1e6f - fallTime <= state->time) {
+            float spawnTime = notes[*cursor].timeUs / 1e6f - fallTime;
+            SpawnArrowInLane(&state->players[0], true, lane, spawnTime);
+            SpawnArrowInLane(&state->players[1], false, lane, spawnTime);
+            (*cursor)++;
+        }
+    }
+}
+
+// Function to tell whether every chart note has been spawned and played out
+static bool ChartFinished(const SimState* state) {
+    for (int lane = 0; lane < SIM_LANES; lane++) {
+        if (state->chartCursor[lane] < state->chart->header->noteCount[lane]) return false;
+        if (state->players[0].lanes[lane].count > 0 || state->players[1].lanes[lane].count > 0) return false;
+    }
+    return true;
+}
+
+// Function to advance the match by one SIM_DT step
+void SimStep(SimState* state, const SimInput* input) {
+    if (state->over) return;
+
+    Player* leftPlayer = &state->players[0];
+    Player* rightPlayer = &state->players[1];
+
+    state->tick++;
+    state->time = state->tick * SIM_DT;
+
+    if (input != NULL) {
+        if (input->pressedDir[0] != SIM_NO_PRESS) state->judged[0] = JudgePress(leftPlayer, rightPlayer, input->pressedDir[0], state->time);
+        if (input->pressedDir[1] != SIM_NO_PRESS) state->judged[1] = JudgePress(rightPlayer, leftPlayer, input->pressedDir[1], state->time);
+    }
+
+    // Spawn arrows from the chart, or based on the current spawn interval
+    if (state->chart != NULL) {
+        SpawnChartNotes(state);
+    } else if (state->tick >= state->nextSpawnTick) {
+        SpawnArrow(leftPlayer, true, state->time, &state->rng);   // Spawn arrow for left player
+        SpawnArrow(rightPlayer, false, state->time, &state->rng); // Spawn arrow for right player
+        state->nextSpawnTick = state->tick + state->spawnIntervalTicks;
+    }
+
+    // Every 15 seconds, reduce the spawn interval by 0.5 seconds, if above the minimum
+    if (state->tick % SIM_TICKS(DIFFICULTY_INCREASE_INTERVAL) == 0) {
+        state->spawnIntervalTicks -= SIM_TICKS(SPAWN_INTERVAL_DECREASE);
+        if (state->spawnIntervalTicks < SIM_TICKS(MIN_SPAWN_INTERVAL)) {
+            state->spawnIntervalTicks = SIM_TICKS(MIN_SPAWN_INTERVAL);
+        }
+    }
+
+    // Expire the arrows that fell off the bottom. Positions are left to the
+    // renderers, which place arrows for their own frame time, so a step costs
+    // the same however many arrows are on screen.
+    float expireTime = state->time - EXPIRE_DELAY;
+    for (int p = 0; p < 2; p++) {
+        for (int lane = 0; lane < SIM_LANES; lane++) ArrowRingExpireBefore(&state->players[p].lanes[lane], expireTime);
+    }
+
+    // Check for game over condition
+    if (leftPlayer->health <= 0 || rightPlayer->health <= 0) {
+        state->over = true;
+    }
+    if (state->chart != NULL && ChartFinished(state)) {
+        state->over = true;
+    }
+}
+
+// Function to find the first tick, from `tick` on, whose step time reaches
+// `time`: from an estimate a little early, walking up with SimStep's own
+// float math so the answer agrees with stepping exactly
+static int FirstTickAt(float time, int tick) {
+    int estimate = (int)(time * SIM_TICK_RATE) - 2;
+    if (estimate > tick) tick = estimate;
+    while (!(tick * SIM_DT >= time)) tick++;
+    return tick;
+}
+
+// Function to find the first tick, from `tick` on, whose step expires an
+// arrow hitting at `hitTime`, the same way
+static int ExpireTick(float hitTime, int tick) {
+    int estimate = (int)((hitTime + EXPIRE_DELAY) * SIM_TICK_RATE) - 2;
+    if (estimate > tick) tick = estimate;
+    while (!(hitTime < tick * SIM_DT - EXPIRE_DELAY)) tick++;
+    return tick;
+}
+
+// Function to find the next tick whose step, without presses, does anything
+// but move the clock: a spawn, a difficulty ramp, an arrow expiring, or the
+// end of a chart. Every step before it can be skipped.
+int SimNextEventTick(const SimState* state) {
+    int next = state->tick + 1;
+    int ramp = SIM_TICKS(DIFFICULTY_INCREASE_INTERVAL);
+    int event = (next + ramp - 1) / ramp * ramp;
+
+    if (state->chart == NULL) {
+        if (state->nextSpawnTick < event) event = state->nextSpawnTick;
+    } else {
+        const ChartHeader* header = state->chart->header;
+        for (int lane = 0; lane < SIM_LANES; lane++) {
+            uint32_t cursor = state->chartCursor[lane];
+            if (cursor >= header->noteCount[lane]) continue;
+            int due = FirstTickAt(state->chart->notes[lane][cursor].timeUs / 1e6f - FALL_TIME, next);
+            if (due < event) event = due;
+        }
+        if (ChartFinished(state)) return next; // The next step ends the match
+    }
+
+    for (int p = 0; p < 2; p++) {
+        for (int lane = 0; lane < SIM_LANES; lane++) {
+            const ArrowRing* ring = &state->players[p].lanes[lane];
+            if (ring->count == 0) continue;
+            int expire = ExpireTick(ring->arrows[ring->head].hitTime, next);
+            if (expire < event) event = expire;
+        }
+    }
+    return event > next ? event : next;
+}
+
+// Function to run the match up to `targetTick` with no presses. Steps that
+// only move the clock are jumped over, so the cost follows what happens in
+// the match rather than the tick rate; the state is the same as stepping
+// every tick.
+void SimAdvance(SimState* state, int targetTick) {
+    while (state->tick < targetTick && !state->over) {
+        int event = SimNextEventTick(state);
+        if (event > targetTick) event = targetTick;
+        state->tick = event - 1;
+        state->time = state->tick * SIM_DT;
+        SimStep(state, NULL);
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "arrow_ring.h"
+#include "chart.h"
+
+// Playfield constants shared by the game and the headless tools
+#define SCREEN_WIDTH 1280
+#define SCREEN_HEIGHT 720
+#define TARGET_ZONE_Y 600
+#define ARROW_SPEED 300.0f
+#define PERFECT_THRESHOLD 25.0f
+#define GOOD_THRESHOLD 50.0f
+#define INITIAL_SPAWN_INTERVAL 2.0f
+#define DIFFICULTY_INCREASE_INTERVAL 15.0f
+#define SPAWN_INTERVAL_DECREASE 0.5f
+#define MIN_SPAWN_INTERVAL 0.5f
+#define PERFECT_DAMAGE 2.5f // dance.c's value; the networked game took 10 before it shared this simulation
+#define UP_DOWN_HITBOX 200.0f
+#define TIMING_RANGE 50.0f
+#define ARROW_SPAWN_Y -50.0f
+#define SIM_LANES 4
+
+#if SIM_LANES != CHART_LANES
+#error "charts and the simulation must agree on the lane count"
+#endif
+
+// Fixed simulation timestep. Presses are judged at tick resolution, so the
+// rate is high enough that quantization stays well under a frame.
+#define SIM_TICK_RATE 1000
+#define SIM_DT (1.0f / SIM_TICK_RATE)
+#define SIM_TICKS(seconds) ((int)((seconds) * SIM_TICK_RATE + 0.5f))
+
+#define SIM_NO_PRESS -1
+
+// Outcome of one press
+typedef enum {
+    JUDGE_MISS,
+    JUDGE_GOOD,
+    JUDGE_PERFECT
+} Judgment;
+
+// Player structure
+typedef struct {
+    int score;
+    float health;
+    char combo[20];
+    ArrowRing lanes[SIM_LANES]; // One queue per direction, ordered by hit time
+    int perfectPresses;
+} Player;
+
+// Whole match state, advanced only by SimStep. Without a chart, arrows depend
+// on nothing but the seed and the step count, so every peer given the seed
+// spawns the same ones. With a chart, both players get its notes.
+typedef struct {
+    Player players[2]; // 0: left, 1: right
+    int tick;               // Steps taken since SimInit
+    int nextSpawnTick;
+    int spawnIntervalTicks;
+    uint32_t rng;           // Chart generator state
+    const Chart* chart;     // NULL for generated arrows
+    uint32_t chartCursor[SIM_LANES]; // Next note to spawn in each lane
+    float time;             // tick * SIM_DT
+    Judgment judged[2];     // Result of each player's press in the last step, if the input had one
+    bool over;
+} SimState;
+
+// Presses for one step: a lane (0-3, same numbering as Arrow.direction) or SIM_NO_PRESS
+typedef struct {
+    int pressedDir[2];
+} SimInput;
+
+void SimInit(SimState* state, uint32_t seed);
+void SimUseChart(SimState* state, const Chart* chart);
+void SimStep(SimState* state, const SimInput* input);
+void SimAdvance(SimState* state, int targetTick);
+int SimNextEventTick(const SimState* state);
+
+uint32_t SimRandom(uint32_t* rng);
+int SpawnArrow(Player* player, bool isLeftSide, float time, uint32_t* rng);
+void SpawnArrowInLane(Player* player, bool isLeftSide, int direction, float time);
+int FindJudgeTarget(ArrowRing* lane, float time);
+Judgment JudgePress(Player* attacker, Player* defender, int pressedDir, float time);
+const char* JudgmentText(Judgment judgment);
+
+#endif
@@ -0,0 +1,223 @@
+#include "songstream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// raylib's stream callback carries no user data, so one song plays at a time
+static SongStream* _Atomic activeSong;
+
+static uint64_t MonotonicNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Function to copy `frames` song frames into the ring at `written`, wrapping at both ends
+static void CopyIntoRing(SongStream* song, unsigned long written, uint32_t frames) {
+    uint32_t ringFrames = song->ringMask + 1;
+    while (frames > 0) {
+        uint32_t slot = (uint32_t)(written & song->ringMask);
+        uint32_t chunk = frames;
+        if (chunk > ringFrames - slot) chunk = ringFrames - slot;
+        if (chunk > song->frameCount - song->feedPosition) chunk = song->frameCount - song->feedPosition;
+        memcpy(song->ring + slot * SONG_CHANNELS, song->pcm + (size_t)song->feedPosition * SONG_CHANNELS, chunk * SONG_CHANNELS * sizeof(int16_t));
+        written += chunk;
+        frames -= chunk;
+        song->feedPosition += chunk;
+        if (song->feedPosition == song->frameCount && song->looping) song->feedPosition = 0;
+    }
+}
+
+// Function to top the ring up with as much of the song as fits; call under feedLock
+static void FeedRing(SongStream* song) {
+    unsigned long written = atomic_load_explicit(&song->written, memory_order_relaxed);
+    unsigned long read = atomic_load_explicit(&song->read, memory_order_acquire);
+    uint32_t space = (song->ringMask + 1) - (uint32_t)(written - read);
+    uint32_t left = song->frameCount - song->feedPosition;
+    uint32_t frames = song->looping || space < left ? space : left;
+    if (frames == 0) return;
+
+    CopyIntoRing(song, written, frames);
+    atomic_store_explicit(&song->written, written + frames, memory_order_release);
+    if (!song->looping && song->feedPosition == song->frameCount) atomic_store(&song->fedAll, true);
+}
+
+static void* SongFeeder(void* arg) {
+    SongStream* song = arg;
+    while (!atomic_load(&song->quit)) {
+        if (atomic_load(&song->playing)) {
+            pthread_mutex_lock(&song->feedLock);
+            FeedRing(song);
+            pthread_mutex_unlock(&song->feedLock);
+        }
+        usleep(song->feedIntervalUs);
+    }
+    return NULL;
+}
+
+// Function to fill the device's buffer from the ring, on raylib's audio
+// thread. Takes no locks and never waits; what the ring lacks is silence.
+static void SongCallback(void* buffer, unsigned int frames) {
+    SongStream* song = atomic_load_explicit(&activeSong, memory_order_acquire);
+    int16_t* out = buffer;
+    if (song == NULL) {
+        memset(out, 0, frames * SONG_CHANNELS * sizeof(int16_t));
+        return;
+    }
+
+    unsigned long read = atomic_load_explicit(&song->read, memory_order_relaxed);
+    unsigned long written = atomic_load_explicit(&song->written, memory_order_acquire);
+
+    // This buffer starts playing about now; readers never block the callback
+    unsigned int sequence = atomic_load_explicit(&song->clockSequence, memory_order_relaxed);
+    atomic_store_explicit(&song->clockSequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&song->clockFrames, read, memory_order_relaxed);
+    atomic_store_explicit(&song->clockNs, MonotonicNs(), memory_order_relaxed);
+    atomic_store_explicit(&song->clockSequence, sequence + 2, memory_order_release);
+
+    uint32_t available = (uint32_t)(written - read);
+    uint32_t count = frames < available ? frames : available;
+    uint32_t slot = (uint32_t)(read & song->ringMask);
+    uint32_t first = count < song->ringMask + 1 - slot ? count : song->ringMask + 1 - slot;
+    memcpy(out, song->ring + slot * SONG_CHANNELS, first * SONG_CHANNELS * sizeof(int16_t));
+    memcpy(out + first * SONG_CHANNELS, song->ring, (count - first) * SONG_CHANNELS * sizeof(int16_t));
+    if (count < frames) {
+        memset(out + count * SONG_CHANNELS, 0, (frames - count) * SONG_CHANNELS * sizeof(int16_t));
+        if (!atomic_load_explicit(&song->fedAll, memory_order_relaxed)) atomic_fetch_add_explicit(&song->underruns, 1, memory_order_relaxed);
+    }
+    atomic_store_explicit(&song->read, read + count, memory_order_release);
+}
+
+// Function to set up streaming of an already decoded song. Takes the wave's
+// samples, converting them to 16-bit stereo if needed. `bufferMs` is the
+// ring depth, the most audio queued ahead of the device.
+bool SongStreamInit(SongStream* song, Wave wave, int bufferMs) {
+    memset(song, 0, sizeof(*song));
+    if (wave.data == NULL || wave.frameCount == 0) return false;
+    if (wave.sampleSize != 16 || wave.channels != SONG_CHANNELS) WaveFormat(&wave, wave.sampleRate, 16, SONG_CHANNELS);
+    song->pcm = wave.data;
+    song->frameCount = wave.frameCount;
+    song->sampleRate = wave.sampleRate;
+    song->looping = true; // As raylib's Music
+
+    if (bufferMs <= 0) bufferMs = SONG_DEFAULT_BUFFER_MS;
+    uint32_t wanted = (uint32_t)((uint64_t)song->sampleRate * bufferMs / 1000);
+    uint32_t ringFrames = 1024;
+    while (ringFrames < wanted) ringFrames <<= 1;
+    song->ring = calloc(ringFrames, SONG_CHANNELS * sizeof(int16_t));
+    if (song->ring == NULL) {
+        UnloadWave(wave);
+        return false;
+    }
+    song->ringMask = ringFrames - 1;
+    song->depthMs = (int)((uint64_t)ringFrames * 1000 / song->sampleRate);
+
+    // Refill four times per ring length, so three quarters stay queued at worst
+    song->feedIntervalUs = (int)((uint64_t)ringFrames * 1000000 / song->sampleRate / 4);
+    atomic_init(&song->written, 0);
+    atomic_init(&song->read, 0);
+    atomic_init(&song->underruns, 0);
+    atomic_init(&song->fedAll, false);
+    atomic_init(&song->clockSequence, 0);
+    atomic_init(&song->clockFrames, 0);
+    atomic_init(&song->clockNs, 0);
+    atomic_init(&song->quit, false);
+    atomic_init(&song->playing, false);
+    pthread_mutex_init(&song->feedLock, NULL);
+
+    if (pthread_create(&song->feeder, NULL, SongFeeder, song) != 0) {
+        pthread_mutex_destroy(&song->feedLock);
+        free(song->ring);
+        UnloadWave(wave);
+        memset(song, 0, sizeof(*song));
+        return false;
+    }
+    song->stream = LoadAudioStream(song->sampleRate, 16, SONG_CHANNELS);
+    atomic_store(&activeSong, song);
+    SetAudioStreamCallback(song->stream, SongCallback);
+    return true;
+}
+
+// Function to play from the start. The ring is filled here, so the device's
+// first callback already finds a full ring.
+void SongStreamPlay(SongStream* song) {
+    if (song->ring == NULL) return;
+    StopAudioStream(song->stream); // The callback is not running once this returns
+    pthread_mutex_lock(&song->feedLock);
+    song->feedPosition = 0;
+    atomic_store(&song->written, 0);
+    atomic_store(&song->read, 0);
+    atomic_store(&song->fedAll, false);
+    atomic_store(&song->clockFrames, 0);
+    atomic_store(&song->clockNs, 0);
+    FeedRing(song);
+    atomic_store(&song->playing, true);
+    pthread_mutex_unlock(&song->feedLock);
+    PlayAudioStream(song->stream);
+}
+
+void SongStreamStop(SongStream* song) {
+    if (song->ring == NULL) return;
+    StopAudioStream(song->stream);
+    atomic_store(&song->playing, false);
+}
+
+void SongStreamSetVolume(SongStream* song, float volume) {
+    if (song->ring != NULL) SetAudioStreamVolume(song->stream, volume);
+}
+
+// Frames the audio callback has taken from the ring since Play
+uint64_t SongStreamFramesRead(const SongStream* song) {
+    return atomic_load_explicit(&song->read, memory_order_acquire);
+}
+
+// Function to get the song's playback position in seconds since Play. The
+// callback only runs every few milliseconds, so between callbacks the
+// position advances with the wall clock, up to the end of the audio the
+// device was given. Can step back slightly when a callback comes late;
+// callers that need a monotonic clock keep the maximum.
+double SongStreamTime(const SongStream* song) {
+    if (song->sampleRate == 0) return 0.0;
+    unsigned int before, after;
+    unsigned long frames;
+    uint64_t ns;
+    do {
+        before = atomic_load_explicit(&song->clockSequence, memory_order_acquire);
+        frames = atomic_load_explicit(&song->clockFrames, memory_order_relaxed);
+        ns = atomic_load_explicit(&song->clockNs, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&song->clockSequence, memory_order_relaxed);
+    } while (before != after || (before & 1));
+    if (ns == 0) return 0.0;
+
+    double time = (double)frames / song->sampleRate + (MonotonicNs() - ns) / 1e9;
+    double handedOver = (double)atomic_load_explicit(&song->read, memory_order_acquire) / song->sampleRate;
+    return time < handedOver ? time : handedOver;
+}
+
+unsigned long SongStreamUnderruns(const SongStream* song) {
+    return atomic_load_explicit(&song->underruns, memory_order_relaxed);
+}
+
+// Audio queued in the ring right now, for the debug overlay
+int SongStreamBufferedMs(const SongStream* song) {
+    if (song->sampleRate == 0) return 0;
+    unsigned long written = atomic_load_explicit(&song->written, memory_order_acquire);
+    unsigned long read = atomic_load_explicit(&song->read, memory_order_acquire);
+    return (int)((written - read) * 1000 / song->sampleRate);
+}
+
+void SongStreamUnload(SongStream* song) {
+    if (song->ring == NULL) return;
+    atomic_store(&song->quit, true);
+    pthread_join(song->feeder, NULL);
+    UnloadAudioStream(song->stream); // Removes the callback before the ring goes
+    SongStream* expected = song;
+    atomic_compare_exchange_strong(&activeSong, &expected, NULL);
+    pthread_mutex_destroy(&song->feedLock);
+    free(song->ring);
+    UnloadWave((Wave){ .data = song->pcm });
+    memset(song, 0, sizeof(*song));
+}
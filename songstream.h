@@ -0,0 +1,61 @@
+#ifndef SONGSTREAM_H
+#define SONGSTREAM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "raylib.h"
+
+// Music playback that does not depend on the game loop. A feeder thread
+// copies the decoded song into a lock-free ring of 16-bit stereo frames;
+// raylib's audio thread pulls from the ring through the stream callback.
+// A long frame on the main thread can no longer starve the audio device.
+// Only as much as the ring holds is buffered, so its depth sets the
+// trade-off between latency and safety margin.
+
+#define SONG_CHANNELS 2
+#define SONG_DEFAULT_BUFFER_MS 100
+
+typedef struct {
+    // Decoded song, owned by the stream
+    int16_t* pcm;
+    uint32_t frameCount;
+    uint32_t sampleRate;
+    bool looping;
+
+    // Ring of PCM frames: the feeder advances `written`, the audio callback `read`
+    int16_t* ring;
+    uint32_t ringMask;               // Ring frames - 1, a power of two
+    int depthMs;                     // Ring length: the bufferMs asked for, rounded up
+    _Alignas(64) atomic_ulong written;
+    _Alignas(64) atomic_ulong read;  // Frames handed to the audio device since Play
+    _Alignas(64) atomic_ulong underruns; // Callbacks the ring could not fill while playing
+    atomic_bool fedAll;              // Whole song is in the ring, a short ring is the end, not an underrun
+
+    // Song clock: frames handed over before the last callback and when it ran.
+    // A sequence lock (odd while the callback writes) keeps the pair consistent.
+    atomic_uint clockSequence;
+    atomic_ulong clockFrames;
+    atomic_ullong clockNs;           // 0 until the first callback after Play
+
+    uint32_t feedPosition;           // Next song frame to copy in; feeder side, under `feedLock`
+    pthread_mutex_t feedLock;        // Feeder vs Play/Stop only, the audio callback never takes it
+    pthread_t feeder;
+    int feedIntervalUs;
+    atomic_bool quit;
+    atomic_bool playing;
+    AudioStream stream;
+} SongStream;
+
+bool SongStreamInit(SongStream* song, Wave wave, int bufferMs);
+void SongStreamPlay(SongStream* song);
+void SongStreamStop(SongStream* song);
+void SongStreamSetVolume(SongStream* song, float volume);
+uint64_t SongStreamFramesRead(const SongStream* song);
+double SongStreamTime(const SongStream* song);
+unsigned long SongStreamUnderruns(const SongStream* song);
+int SongStreamBufferedMs(const SongStream* song);
+void SongStreamUnload(SongStream* song);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+// Lock-free single-producer/single-consumer ring of fixed-size elements.
+// One thread pushes, one other thread pops; neither ever blocks the other.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    _Alignas(64) atomic_size_t head; // Next slot to pop, written by the consumer
+    _Alignas(64) atomic_size_t tail; // Next slot to push, written by the producer
+    _Alignas(64) size_t mask;        // Capacity - 1, capacity is a power of two
+    size_t elemSize;
+    unsigned char* data;
+} SpscQueue;
+
+// Function to allocate a queue holding at least `capacity` elements
+static inline bool SpscQueueInit(SpscQueue* queue, size_t capacity, size_t elemSize) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+
+    queue->data = malloc(size * elemSize);
+    if (queue->data == NULL) return false;
+    queue->mask = size - 1;
+    queue->elemSize = elemSize;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return true;
+}
+
+static inline void SpscQueueFree(SpscQueue* queue) {
+    free(queue->data);
+    queue->data = NULL;
+}
+
+// Producer only: copy one element in, false when the queue is full
+static inline bool SpscQueuePush(SpscQueue* queue, const void* elem) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head > queue->mask) return false;
+
+    memcpy(queue->data + (tail & queue->mask) * queue->elemSize, elem, queue->elemSize);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Consumer only: copy one element out, false when the queue is empty
+static inline bool SpscQueuePop(SpscQueue* queue, void* elem) {
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) return false;
+
+    memcpy(elem, queue->data + (head & queue->mask) * queue->elemSize, queue->elemSize);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Elements currently queued; exact from either side, approximate from a third thread
+static inline size_t SpscQueueDepth(SpscQueue* queue) {
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    return tail - head;
+}
+
+#endif